@@ -21,16 +21,30 @@
 
 #define _GNU_SOURCE
 #include "apis.h"
+// perfect hash tables over the names in apis.h, built by phash.c
+#include "apis_names.h"
 
 // session
+// changes are written behind: session_flush() runs once the event queue drains
 void session_set(char *key, char *val, bool copy)
 {
 	char *s = hash_get(session, key);
+	if (s && strcmp(s, val) == 0)
+	{
+		if (!copy) free(val);
+		return;
+	}
 	free(s);
 	hash_set(session, key, copy ? strdup(val): val);
-	s = hash_encode(session);
+	session_dirty = 1;
+}
+void session_flush()
+{
+	if (!session_dirty) return;
+	char *s = hash_encode(session);
 	XAtomSetString(display, ApisSession, root, s);
 	free(s);
+	session_dirty = 0;
 }
 char* session_get(char *key, char *def)
 {
@@ -106,23 +120,78 @@ bool box_intersect(box *s, int x, int y, int width, int height)
 	bool overlap_y = region_overlap_y(s->x, s->y, s->w, s->h, x, y, width, height);
 	return overlap_x && overlap_y ? 1:0;
 }
+// "v2 w h active flags count x y w h ..." with only the fields that outlive
+// the process; window ids and pointers are rebuilt on load
 char* grid_dump(grid *g)
 {
-	return mem2str(g, sizeof(grid));
+	autostr s; str_create(&s);
+	int i; box *b;
+	str_print(&s, NOTE, "v%d %d %d %d %u %d", GRID_FORMAT, g->w, g->h, g->active,
+		g->flags & GRID_PERSIST, g->count);
+	FOR_BOXES (b, g, i)
+		str_print(&s, NOTE, " %d %d %d %d", b->x, b->y, b->w, b->h);
+	return s.pad;
+}
+// older snapshots were the raw memory of a whole fixed grid
+bool grid_load_legacy(grid *g, char *desc)
+{
+	int i;
+	legacy_grid *old = allocate(sizeof(legacy_grid));
+	memset(old, 0, sizeof(legacy_grid));
+	str2mem(old, sizeof(legacy_grid), desc);
+	if (old->count < 1 || old->count > LEGACY_BOXES) { free(old); return 0; }
+	grid_reserve(g, old->count);
+	g->w = old->w; g->h = old->h; g->count = old->count;
+	g->active = MIN(old->count-1, MAX(0, old->active)); g->flags = old->flags & GRID_PERSIST;
+	for (i = 0; i < old->count; i++)
+		box_init(&g->boxes[i], old->boxes[i].x, old->boxes[i].y, old->boxes[i].w, old->boxes[i].h);
+	free(old);
+	return 1;
 }
 void grid_load(grid *g, char *desc)
 {
-	str2mem(g, sizeof(grid), desc);
+	int version, w, h, active, count, i, n; ucell flags; char *p = desc;
+	// raw snapshots are hex digits, so only a versioned one starts with v
+	if (*p != 'v')
+	{
+		if (!grid_load_legacy(g, desc)) crap("ignoring unreadable grid snapshot");
+		return;
+	}
+	if (sscanf(p, "v%d %d %d %d %u %d%n", &version, &w, &h, &active, &flags, &count, &n) != 6
+		|| version != GRID_FORMAT || count < 1 || count > BOXES_MAX)
+	{
+		crap("ignoring unreadable grid snapshot");
+		return;
+	}
+	box *boxes = allocate(sizeof(box) * count);
+	for (p += n, i = 0; i < count; i++, p += n)
+	{
+		int x, y, bw, bh;
+		if (sscanf(p, "%d %d %d %d%n", &x, &y, &bw, &bh, &n) != 4) break;
+		box_init(&boxes[i], x, y, bw, bh);
+	}
+	// keep the default grid rather than load a truncated one
+	if (i == count)
+	{
+		grid_reserve(g, count);
+		memmove(g->boxes, boxes, sizeof(box) * count);
+		g->w = w; g->h = h; g->count = count;
+		g->active = MIN(count-1, MAX(0, active)); g->flags = flags & GRID_PERSIST;
+	}
+	free(boxes);
 }
 void grid_snapshot(grid *g, int id)
 {
 	char key[NOTE]; sprintf(key, "grid%d", id);
 	session_set(key, grid_dump(g), 0);
+	hook_run(HOOK_GRID, "%d\t%d\t%d", id, g->count, g->active);
 }
 grid* grid_create(int w, int h)
 {
 	grid *g = allocate(sizeof(grid));
 	memset(g, 0, sizeof(grid));
+	g->limit = BOXES; g->boxes = allocate(sizeof(box) * g->limit);
+	g->loglimit = BOXES; g->log = allocate(sizeof(boxlog) * g->loglimit);
 	g->w = w; g->h = h; g->count = 0;
 	box_init(&g->boxes[g->count++], 0, 0, w, h);
 	g->flags = 0; g->active = 0;
@@ -131,24 +200,53 @@ grid* grid_create(int w, int h)
 void grid_free(grid *g)
 {
 	box *b; int i;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 		box_free(b);
+	free(g->boxes); free(g->log);
 	free(g);
 }
-grid *grid_copy(grid *g)
+void grid_reserve(grid *g, ucell count)
+{
+	if (count <= g->limit) return;
+	while (g->limit < count) g->limit *= 2;
+	g->boxes = reallocate(g->boxes, sizeof(box) * g->limit);
+}
+// start a change: the log records only boxes that get touched
+void grid_begin(grid *g)
+{
+	g->logged = 0;
+	g->was_w = g->w; g->was_h = g->h;
+	g->was_count = g->count; g->was_active = g->active;
+}
+// call before modifying a box
+void grid_touch(grid *g, box *b)
 {
-	grid *cpy = allocate(sizeof(grid));
-	memmove(cpy, g, sizeof(grid));
-	return cpy;
+	if (g->logged == g->loglimit)
+	{
+		g->loglimit *= 2;
+		g->log = reallocate(g->log, sizeof(boxlog) * g->loglimit);
+	}
+	boxlog *l = &g->log[g->logged++];
+	l->index = b - g->boxes; l->old = *b;
+}
+void grid_rollback(grid *g)
+{
+	while (g->logged > 0)
+	{
+		boxlog *l = &g->log[--g->logged];
+		g->boxes[l->index] = l->old;
+	}
+	g->w = g->was_w; g->h = g->was_h;
+	g->count = g->was_count; g->active = g->was_active;
 }
 void grid_make_gap(grid *g, int x, int y, int w, int h, box *except)
 {
 	int i; box *o;
-	FOR_ARRAY_PART (o, g->boxes, box, i, g->count)
+	FOR_BOXES (o, g, i)
 	{
 		if (o != except && box_intersect(o, x+1, y+1, w-2, h-2))
 		{
-			int d = 0;
+			int d = 0; grid_touch(g, o);
 			if (o->x >= x && o->x+o->w > x+w) { d = x+w-o->x; o->x += d; o->w -= d; }
 			if (o->x+o->w <= x+w && o->x < x) { o->w = x-o->x; }
 			if (o->y >= y && o->y+o->h > y+h) { d = y+h-o->y; o->y += d; o->h -= d; }
@@ -167,7 +265,7 @@ bool grid_fill_gap(grid *g, int x, int y, int w, int h, box *except)
 	limits[4] = limits[5] = x + (w/2);
 	limits[6] = limits[7] = x + (w/2);
 	// group by sides
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		if (b == except) continue;
 		ubyte side = box_adjacent_within(b, x, y, w, h);
@@ -206,29 +304,34 @@ bool grid_fill_gap(grid *g, int x, int y, int w, int h, box *except)
 	// if any, choose fewest boxes, resize, exit
 	if (s > -1 && c > 0)
 	{
-		FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+		FOR_BOXES (b, g, i)
 		{
 			if (b == except) continue;
-			     if (s == 0 && box_adjacent_within(b, x, y, w, h) == RIGHT)  b->w += w;
-			else if (s == 1 && box_adjacent_within(b, x, y, w, h) == LEFT) { b->x -= w; b->w += w; }
-			else if (s == 2 && box_adjacent_within(b, x, y, w, h) == BOTTOM) b->h += h;
-			else if (s == 3 && box_adjacent_within(b, x, y, w, h) == TOP)  { b->y -= h; b->h += h; }
+			ubyte side = box_adjacent_within(b, x, y, w, h);
+			if ((s == 0 && side == RIGHT) || (s == 1 && side == LEFT)
+				|| (s == 2 && side == BOTTOM) || (s == 3 && side == TOP))
+				grid_touch(g, b);
+			     if (s == 0 && side == RIGHT)  b->w += w;
+			else if (s == 1 && side == LEFT) { b->x -= w; b->w += w; }
+			else if (s == 2 && side == BOTTOM) b->h += h;
+			else if (s == 3 && side == TOP)  { b->y -= h; b->h += h; }
 		}
 		return 1;
 	}
 	return 0;
 }
-bool grid_check_boxes(grid *g)
+// reference O(n^2) checks, kept for GRID_CHECK_DIFF
+bool grid_check_boxes_pairwise(grid *g)
 {
 	int i, j; box *b, *o;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		if (b->w < 50 || b->h < 50)
 			return 0;
 	}
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
-		FOR_ARRAY_PART (o, g->boxes, box, j, g->count)
+		FOR_BOXES (o, g, j)
 		{
 			if (o == b) continue;
 			if (box_intersect(o, b->x+1, b->y+1, b->w-2, b->h-2))
@@ -237,20 +340,20 @@ bool grid_check_boxes(grid *g)
 	}
 	return 1;
 }
-bool grid_check_empty(grid *g)
+bool grid_check_empty_pairwise(grid *g)
 {
 	// every box should have other boxes adjacent to all sides, or be
 	// itself adjacent to a grid side.
 	int i, j; box *b, *o;
 	if (!g->count) return 0;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		int left = 0, right = 0, top = 0, bottom = 0;
 		if (b->x == 0) left = b->h;
 		if (b->y == 0) top  = b->w;
 		if (b->x + b->w == g->w) right  = b->h;
 		if (b->y + b->h == g->h) bottom = b->w;
-		FOR_ARRAY_PART (o, g->boxes, box, j, g->count)
+		FOR_BOXES (o, g, j)
 		{
 			if (o == b) continue;
 			ubyte side = box_adjacent(o, b->x, b->y, b->w, b->h);
@@ -269,43 +372,237 @@ bool grid_check_empty(grid *g)
 	}
 	return 1;
 }
+int boxevent_cmp(const void *a, const void *b)
+{
+	const boxevent *x = a, *y = b;
+	if (x->at != y->at) return x->at < y->at ? -1: 1;
+	// leave before enter at the same coordinate
+	return x->in - y->in;
+}
+// index of the first span starting after s
+int span_after(span *a, int n, int s)
+{
+	int lo = 0, hi = n;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (a[mid].s <= s) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+// boxes at least 50x50, no two overlapping by 2 or more in both axes.
+// trimming one unit off each far edge turns that into plain half-open
+// rectangle intersection, found by sweeping x with the active y spans kept
+// sorted and disjoint: a new span can only hit its neighbours
+bool grid_check_boxes(grid *g)
+{
+	int i, n = 0, live = 0; box *b; bool ok = 1;
+	FOR_BOXES (b, g, i)
+		if (b->w < 50 || b->h < 50) return 0;
+	boxevent *ev = allocate(sizeof(boxevent) * g->count * 2);
+	span *act = allocate(sizeof(span) * (g->count + 1));
+	FOR_BOXES (b, g, i)
+	{
+		boxevent *in = &ev[n++], *out = &ev[n++];
+		in->at = b->x; out->at = b->x + b->w - 1;
+		in->s = out->s = b->y; in->e = out->e = b->y + b->h - 1;
+		in->in = 1; out->in = 0;
+	}
+	qsort(ev, n, sizeof(boxevent), boxevent_cmp);
+	for (i = 0; ok && i < n; i++)
+	{
+		int p = span_after(act, live, ev[i].s);
+		if (ev[i].in)
+		{
+			if ((p > 0 && act[p-1].e > ev[i].s) || (p < live && act[p].s < ev[i].e))
+				ok = 0;
+			else
+			{
+				memmove(&act[p+1], &act[p], (live - p) * sizeof(span));
+				act[p].s = ev[i].s; act[p].e = ev[i].e; live++;
+			}
+		} else
+		if (p > 0 && act[p-1].s == ev[i].s)
+		{
+			memmove(&act[p-1], &act[p], (live - p) * sizeof(span));
+			live--;
+		}
+	}
+	free(ev); free(act);
+	return ok;
+}
+int boxedge_cmp(const void *a, const void *b)
+{
+	const boxedge *x = a, *y = b;
+	if (x->at != y->at) return x->at < y->at ? -1: 1;
+	return x->far - y->far;
+}
+int coverage_cmp(const void *a, const void *b)
+{
+	const coverage *x = a, *y = b;
+	return x->at < y->at ? -1: x->at > y->at ? 1: 0;
+}
+ucell coverage_build(coverage *c, boxedge *e, int n)
+{
+	int i, m = 0;
+	for (i = 0; i < n; i++)
+	{
+		c[m].at = e[i].s; c[m++].delta = 1;
+		c[m].at = e[i].e; c[m++].delta = -1;
+	}
+	qsort(c, m, sizeof(coverage), coverage_cmp);
+	dcell area = 0; int depth = 0;
+	for (i = 0; i < m; i++)
+	{
+		if (i) area += (dcell)depth * (c[i].at - c[i-1].at);
+		depth += c[i].delta;
+		c[i].area = area; c[i].depth = depth;
+	}
+	return m;
+}
+// covered length up to t, counting overlapping spans once each
+dcell coverage_at(coverage *c, int m, int t)
+{
+	int lo = 0, hi = m;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (c[mid].at <= t) lo = mid + 1; else hi = mid;
+	}
+	return lo ? c[lo-1].area + (dcell)c[lo-1].depth * (t - c[lo-1].at): 0;
+}
+// every side of every box either lies on the grid edge or is fully lined by
+// neighbours whose opposite side is on the same line. edges are grouped by
+// line, and each side sums its overlap with the other group in O(log n)
+bool grid_check_side(grid *g, ubyte vertical)
+{
+	int i, j, k, n = 0, limit = vertical ? g->w: g->h; box *b; bool ok = 1;
+	boxedge *e = allocate(sizeof(boxedge) * g->count * 2);
+	coverage *near = allocate(sizeof(coverage) * g->count * 4);
+	coverage *far = near + g->count * 2;
+	FOR_BOXES (b, g, i)
+	{
+		int at = vertical ? b->x: b->y, len = vertical ? b->w: b->h;
+		int s = vertical ? b->y: b->x, l = vertical ? b->h: b->w;
+		e[n].at = at; e[n].s = s; e[n].e = s + l; e[n].box = i; e[n++].far = 0;
+		e[n].at = at + len; e[n].s = s; e[n].e = s + l; e[n].box = i; e[n++].far = 1;
+	}
+	qsort(e, n, sizeof(boxedge), boxedge_cmp);
+	for (i = 0; ok && i < n; i = j)
+	{
+		for (k = i; k < n && e[k].at == e[i].at && !e[k].far; k++);
+		for (j = k; j < n && e[j].at == e[i].at; j++);
+		// [i,k) are near sides on this line, [k,j) far sides
+		ucell nn = coverage_build(near, &e[i], k - i);
+		ucell nf = coverage_build(far, &e[k], j - k);
+		int t;
+		for (t = i; ok && t < j; t++)
+		{
+			int need = e[t].e - e[t].s;
+			if (e[t].far ? e[t].at == limit: e[t].at == 0) continue;
+			coverage *c = e[t].far ? near: far; ucell m = e[t].far ? nn: nf;
+			if (coverage_at(c, m, e[t].e) - coverage_at(c, m, e[t].s) < need)
+				ok = 0;
+		}
+	}
+	free(e); free(near);
+	return ok;
+}
+bool grid_check_empty(grid *g)
+{
+	if (!g->count) return 0;
+	return grid_check_side(g, 1) && grid_check_side(g, 0);
+}
 bool grid_check(grid *g)
 {
+#if GRID_CHECK_DIFF
+	bool slow = grid_check_boxes_pairwise(g) && grid_check_empty_pairwise(g);
+	bool fast = grid_check_boxes(g) && grid_check_empty(g);
+	if (slow != fast) crap("grid_check mismatch: pairwise %d sweep %d", slow, fast);
+	return slow;
+#endif
 	if (!grid_check_boxes(g)) return 0;
 	if (!grid_check_empty(g)) return 0;
 	return 1;
 }
-bool grid_autocommit(grid *g, grid *cpy)
+#if GRID_CHECK_DIFF
+// randomized differential test of the sweep checks against the pairwise ones
+bool grid_fuzz(ucell rounds)
+{
+	ucell r, bad = 0; int i;
+	grid *g = grid_create(400, 400);
+	srand(time(0));
+	for (r = 0; r < rounds; r++)
+	{
+		g->count = 0; g->w = 200 + rand() % 200; g->h = 200 + rand() % 200;
+		if (r % 2)
+		{
+			// arbitrary boxes near the size limits, mostly invalid
+			int n = 1 + rand() % 12;
+			grid_reserve(g, n);
+			for (i = 0; i < n; i++)
+				box_init(&g->boxes[g->count++], rand() % g->w - 20, rand() % g->h - 20,
+					1 + rand() % 150, 1 + rand() % 150);
+		} else
+		{
+			// random splits with jittered edges, mostly valid
+			box_init(&g->boxes[g->count++], 0, 0, g->w, g->h);
+			int n = rand() % 10;
+			for (i = 0; i < n; i++)
+			{
+				grid_reserve(g, g->count+1);
+				box *b = &g->boxes[rand() % g->count], *c = &g->boxes[g->count++];
+				*c = *b;
+				if (rand() % 2) { int d = b->w/2 + rand() % 3 - 1; c->x += d; c->w -= d; b->w = d + rand() % 3 - 1; }
+				else            { int d = b->h/2 + rand() % 3 - 1; c->y += d; c->h -= d; b->h = d + rand() % 3 - 1; }
+			}
+		}
+		bool slow = grid_check_boxes_pairwise(g), fast = grid_check_boxes(g);
+		if (slow != fast) bad++;
+		// the coverage sums agree on any boxes with positive sizes
+		bool positive = 1; box *b;
+		FOR_BOXES (b, g, i) if (b->w < 1 || b->h < 1) positive = 0;
+		if (positive && grid_check_empty_pairwise(g) != grid_check_empty(g)) bad++;
+	}
+	grid_free(g);
+	printf("%u rounds, %u mismatches\n", rounds, bad);
+	return bad == 0;
+}
+#endif
+bool grid_autocommit(grid *g)
 {
 	bool res = grid_check(g);
-	if (!res) memmove(g, cpy, sizeof(grid));
-	free(cpy);
+	if (!res) grid_rollback(g);
+	g->logged = 0;
 	return res;
 }
 bool grid_insert(grid *g, int x, int y, int w, int h)
 {
-	if (g->count == BOXES) return 0;
-	grid *cpy = grid_copy(g);
+	grid_reserve(g, g->count+1);
+	grid_begin(g);
 	grid_make_gap(g, x, y, w, h, NULL);
 	box_init(&g->boxes[g->count++], x, y, w, h);
-	return grid_autocommit(g, cpy);
+	return grid_autocommit(g);
 }
 bool grid_remove(grid *g, int index)
 {
 	if (g->count == 1 || index >= g->count) return 0;
-	grid *cpy = grid_copy(g);
-	box *b = &g->boxes[index];
-	int x = b->x, y = b->y, w = b->w, h = b->h;
-	box_free(b); box *n = &g->boxes[index+1];
-	memmove(b, n, (g->count - index + 1) * sizeof(box));
-	g->count--; grid_fill_gap(g, x, y, w, h, NULL);
+	grid_begin(g);
+	int i; box gone = g->boxes[index];
+	// everything after index shifts down
+	for (i = index; i < g->count; i++) grid_touch(g, &g->boxes[i]);
+	memmove(&g->boxes[index], &g->boxes[index+1], (g->count - index - 1) * sizeof(box));
+	g->count--; grid_fill_gap(g, gone.x, gone.y, gone.w, gone.h, NULL);
 	if (index == g->active) g->active = 0;
-	return grid_autocommit(g, cpy);
+	else if (index < g->active) g->active--;
+	if (!grid_autocommit(g)) return 0;
+	box_free(&gone);
+	return 1;
 }
 bool grid_resize(grid *g, int index, int x, int y, int w, int h)
 {
 	if (g->count == 1 || index >= g->count) return 0;
-	grid *cpy = grid_copy(g);
+	grid_begin(g);
 	box *b = &g->boxes[index];
 	// find any siblings, then transpose to covering box opposite
 	grid_make_gap(g, x, y, w, h, b);
@@ -313,12 +610,13 @@ bool grid_resize(grid *g, int index, int x, int y, int w, int h)
 	if (y > b->y) grid_fill_gap(g, b->x, b->y, b->w, y-b->y, b);
 	if ((x+w) < (b->x+b->w)) grid_fill_gap(g, x+w, b->y, (b->x+b->w)-(x+w), b->h, b);
 	if ((y+h) < (b->y+b->h)) grid_fill_gap(g, b->x, y+h, b->w, (b->y+b->h)-(y+h), b);
+	grid_touch(g, b);
 	b->x = x; b->y = y; b->w = w; b->h = h;
-	return grid_autocommit(g, cpy);
+	return grid_autocommit(g);
 }
 bool grid_adjust(grid *g, int w, int h)
 {
-	grid *cpy = grid_copy(g);
+	grid_begin(g);
 	int cw = g->w, ch = g->h;
 	int dw = abs(cw - w), dh = abs(ch - h);
 	if (w > cw)
@@ -342,14 +640,14 @@ bool grid_adjust(grid *g, int w, int h)
 		grid_make_gap(g, 0, h, cw, dh, NULL);
 		g->h = h;
 	}
-	return grid_autocommit(g, cpy);
+	return grid_autocommit(g);
 }
 // grid extensions
 void grid_hide(grid *g)
 {
 	if (!(g->flags & GRID_VISIBLE)) return;
 	int i; box *b;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		XUnmapWindow(display, b->l); XUnmapWindow(display, b->r);
 		XUnmapWindow(display, b->t); XUnmapWindow(display, b->b);
@@ -363,7 +661,7 @@ void grid_show(grid *g)
 {
 	int i; box *b;
 	XSetWindowAttributes attr; attr.override_redirect = True;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		char width = 2;
 		char *color = (b == &g->boxes[g->active]) ? "Blue": "Red";
@@ -396,6 +694,38 @@ void grid_show(grid *g)
 	}
 	g->flags |= GRID_VISIBLE;
 }
+bool grid_rescale(grid *g, int w, int h)
+{
+	int ow = MAX(1, g->w), oh = MAX(1, g->h);
+	box *b; int i;
+	grid_begin(g);
+	FOR_BOXES (b, g, i)
+	{
+		grid_touch(g, b);
+		int x = scale_edge(b->x, ow, w), y = scale_edge(b->y, oh, h);
+		b->w = scale_edge(b->x + b->w, ow, w) - x;
+		b->h = scale_edge(b->y + b->h, oh, h) - y;
+		b->x = x; b->y = y;
+	}
+	g->w = w; g->h = h;
+	return grid_autocommit(g);
+}
+// bring desktop d's grid to the screen size; hidden desktops are left until shown
+bool grid_fit(int d)
+{
+	grid *g = grids[d];
+	if (g->w == screen_width && g->h == screen_height) return 0;
+	if (!grid_rescale(g, screen_width, screen_height))
+	{
+		// too small to keep the layout
+		ucell flags = g->flags;
+		grid_free(g);
+		g = grids[d] = grid_create(screen_width, screen_height);
+		g->flags = flags;
+	}
+	grid_snapshot(g, d);
+	return 1;
+}
 void grid_configure(grid *g)
 {
 	if (g->flags & GRID_VISIBLE) grid_show(g);
@@ -404,7 +734,7 @@ box* grid_box_by_region(grid *g, int x, int y, int w, int h)
 {
 	x += pad_left; y += pad_top;
 	box *b, *nearest = NULL; int i, overlap = 0;
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 	{
 		ubyte side = box_intersect(b, x, y, w, h);
 		if (side)
@@ -421,42 +751,133 @@ box* grid_box_by_region(grid *g, int x, int y, int w, int h)
 	return nearest;
 }
 // rules
+ucell rule_bits[RULE_FIELDS] = { RULE_CLASS, RULE_NAME, RULE_ROLE, RULE_TYPE, RULE_TAG };
+bool rule_literal(rule *r, char *class)
+{
+	char *s;
+	switch (r->litmode)
+	{
+		case LIT_EXACT:
+			return strcasecmp(r->lit, class) == 0;
+		case LIT_PREFIX:
+			return strncasecmp(r->lit, class, r->litlen) == 0;
+		case LIT_SUBSTR:
+			for (s = class; *s; s++)
+				if (strncasecmp(r->lit, s, r->litlen) == 0) return 1;
+			return 0;
+	}
+	return 1;
+}
 ucell rule_match(rule *r, char *class, char *name, char *role, char *type, char *tag)
 {
-	bool cf = r->rflags & RULE_CLASS && class
-		&& regmatch(r->class, class, 0, NULL, REG_EXTENDED|REG_ICASE) == 0 ? 1:0;
-	bool nf = r->rflags & RULE_NAME  && name
-		&& regmatch(r->name,  name,  0, NULL, REG_EXTENDED|REG_ICASE) == 0 ? 1:0;
-	bool rf = r->rflags & RULE_ROLE  && role
-		&& regmatch(r->role,  role,  0, NULL, REG_EXTENDED|REG_ICASE) == 0 ? 1:0;
-	bool tf = r->rflags & RULE_TYPE  && type
-		&& regmatch(r->type,  type,  0, NULL, REG_EXTENDED|REG_ICASE) == 0 ? 1:0;
-	bool gf = r->rflags & RULE_TAG   && tag
-		&& regmatch(r->tag,   tag,   0, NULL, REG_EXTENDED|REG_ICASE) == 0 ? 1:0;
-	if (r->rflags & RULE_CLASS && !cf) return 0;
-	if (r->rflags & RULE_NAME  && !nf) return 0;
-	if (r->rflags & RULE_ROLE  && !rf) return 0;
-	if (r->rflags & RULE_TYPE  && !tf) return 0;
-	if (r->rflags & RULE_TAG   && !gf) return 0;
-	return cf + nf + rf + tf + gf;
+	char *subjects[RULE_FIELDS] = { class, name, role, type, tag };
+	ucell i, hits = 0;
+	// cheap literal test before any regex
+	if (r->litmode && !(class && rule_literal(r, class))) return 0;
+	for (i = 0; i < RULE_FIELDS; i++)
+	{
+		if (!(r->rflags & rule_bits[i])) continue;
+		if (!subjects[i] || !(r->compiled & rule_bits[i])
+			|| regexec(&r->re[i], subjects[i], 0, NULL, 0) != 0)
+			return 0;
+		hits++;
+	}
+	return hits;
+}
+// highest scoring rule in s, oldest first on a tie
+rule* rule_best(stack *s, rule *match, ucell *most, char *class, char *name, char *role, char *type, char *tag)
+{
+	int i; rule *r; ucell this;
+	FOR_STACK (r, s, rule*, i)
+	{
+		this = rule_match(r, class, name, role, type, tag);
+		if (this > *most || (this && this == *most && r->seq < match->seq))
+		{
+			*most = this;
+			match = r;
+		}
+	}
+	return match;
 }
 rule* rule_find(char *class, char *name, char *role, char *type, char *tag)
 {
-	int i; rule *r, *match = NULL;
+	rule *match = NULL; stack *s;
 	if (class || name || role || type)
 	{
 		ucell most = 0;
-		FOR_STACK (r, rules, rule*, i)
+		if (class && (s = hash_get(rules_exact, class)) != NULL)
+			match = rule_best(s, match, &most, class, name, role, type, tag);
+		match = rule_best(rules_scan, match, &most, class, name, role, type, tag);
+	}
+	return match;
+}
+// find the literal run every class match must contain: ^lit$ exact, ^lit prefix, lit substring
+void rule_literal_scan(rule *r)
+{
+	char *p = r->class; ucell len = 0; bool anchored = 0;
+	r->litmode = LIT_NONE; r->lit[0] = '\0'; r->litlen = 0;
+	// alternation could bypass any literal
+	if (!(r->rflags & RULE_CLASS) || strchr(p, '|')) return;
+	if (*p == '^') { anchored = 1; p++; }
+	while (*p && (!strchr(".[]()*+?{}^$\\", *p) || (*p == '\\' && p[1] && !isalnum(p[1]))))
+	{
+		if (*p == '\\') p++;
+		r->lit[len++] = *p++;
+	}
+	// a quantifier may make the last character optional
+	if (len && (*p == '*' || *p == '?' || *p == '{')) len--;
+	r->lit[len] = '\0'; r->litlen = len;
+	if (!len) return;
+	if (anchored && p[0] == '$' && !p[1]) r->litmode = LIT_EXACT;
+	else r->litmode = anchored ? LIT_PREFIX: LIT_SUBSTR;
+}
+void rule_compile(rule *r)
+{
+	char *patterns[RULE_FIELDS] = { r->class, r->name, r->role, r->type, r->tag };
+	ucell i;
+	r->compiled = 0;
+	for (i = 0; i < RULE_FIELDS; i++)
+		if (r->rflags & rule_bits[i]
+			&& regcomp(&r->re[i], patterns[i], REG_EXTENDED|REG_ICASE|REG_NOSUB) == 0)
+			r->compiled |= rule_bits[i];
+	rule_literal_scan(r);
+}
+void rule_free(rule *r)
+{
+	ucell i;
+	for (i = 0; i < RULE_FIELDS; i++)
+		if (r->compiled & rule_bits[i]) regfree(&r->re[i]);
+	free(r);
+}
+void rule_add(rule *r)
+{
+	stack *s;
+	r->seq = rule_seq++;
+	rules_version++;
+	stack_push(rules, r);
+	if (r->litmode == LIT_EXACT)
+	{
+		if (!(s = hash_get(rules_exact, r->lit)))
+			hash_set(rules_exact, r->lit, (s = stack_create()));
+		stack_push(s, r);
+	}
+	else stack_push(rules_scan, r);
+}
+void rule_remove(rule *r)
+{
+	stack *s;
+	rules_version++;
+	stack_discard(rules, r);
+	if (r->litmode == LIT_EXACT)
+	{
+		if ((s = hash_get(rules_exact, r->lit)) != NULL)
 		{
-			ucell this = rule_match(r, class, name, role, type, tag);
-			if (this > most)
-			{
-				most = this;
-				match = r;
-			}
+			stack_discard(s, r);
+			if (!s->depth) stack_free(hash_del(rules_exact, r->lit));
 		}
 	}
-	return match;
+	else stack_discard(rules_scan, r);
+	rule_free(r);
 }
 rule* rule_create(ucell rflags, char *class, char *name, char *role, char *type, char *tag, byte desktop, ucell setflags, ucell clrflags, ucell flipflags, int x, int y, int w, int h, int f, int cols, int rows)
 {
@@ -478,8 +899,111 @@ rule* rule_create(ucell rflags, char *class, char *name, char *role, char *type,
 	if (rflags & RULE_COLS) r->cols = cols;
 	if (rflags & RULE_FLAGS) { r->setflags = setflags; r->clrflags = clrflags; r->flipflags = flipflags; }
 	r->rflags = rflags;
+	rule_compile(r);
 	return r;
 }
+// transient graph: parent window -> winlist of its transients
+void transient_link(Window parent, Window kid)
+{
+	if (parent == None) return;
+	winlist *kids = table_get(transients, parent);
+	if (!kids)
+	{
+		kids = winlist_init(allocate(sizeof(winlist)));
+		table_set(transients, parent, kids);
+	}
+	if (winlist_find(kids, kid) < 0) winlist_push(kids, kid);
+}
+void transient_unlink(Window parent, Window kid)
+{
+	winlist *kids;
+	if (parent == None || !(kids = table_get(transients, parent))) return;
+	winlist_discard(kids, kid);
+	if (!kids->depth) transient_forget(parent);
+}
+void transient_forget(Window parent)
+{
+	winlist *kids = table_del(transients, parent);
+	if (kids) { winlist_free(kids); free(kids); }
+}
+// stacking order mirror, bottom to top, kept in step by root SubstructureNotify events
+void stacking_sync()
+{
+	Window d1, d2, *wins = NULL; ucell num, i;
+	stacking.depth = 0;
+	if (XQueryTree(display, root, &d1, &d2, &wins, &num))
+		for (i = 0; i < num; i++) winlist_push(&stacking, wins[i]);
+	if (wins) XFree(wins);
+}
+// place directly above sibling, or at the bottom if sibling is None
+void stacking_place(Window w, Window sibling)
+{
+	int i = 0;
+	winlist_discard(&stacking, w);
+	if (sibling != None && (i = winlist_find(&stacking, sibling)) < 0)
+	{
+		JOT("stacking: unknown sibling 0x%lx", sibling);
+		stacking_sync();
+		return;
+	}
+	winlist_insert(&stacking, sibling != None ? i+1: 0, w);
+}
+void stacking_raise(Window w)
+{
+	winlist_discard(&stacking, w);
+	winlist_push(&stacking, w);
+}
+// mirror XRestackWindows(): each window goes directly below its predecessor
+void stacking_restack(Window *wins, ucell num)
+{
+	int i, j;
+	for (i = 1; i < num; i++)
+	{
+		if (winlist_find(&stacking, wins[i]) < 0) continue;
+		winlist_discard(&stacking, wins[i]);
+		if ((j = winlist_find(&stacking, wins[i-1])) > -1)
+			winlist_insert(&stacking, j, wins[i]);
+		else winlist_push(&stacking, wins[i]);
+	}
+}
+// callbacks may restack, so walk a snapshot
+Window stacking_iterate(XIterator cb, void *ptr)
+{
+	Window ret = None; ucell i;
+	winlist wins; winlist_init(&wins);
+	for (i = 0; i < stacking.depth; i++) winlist_push(&wins, stacking.items[i]);
+	for (i = 0; i < wins.depth && cb(wins.items[i], ptr); i++);
+	if (i < wins.depth) ret = wins.items[i];
+	winlist_free(&wins);
+	return ret;
+}
+Window stacking_iterate_back(XIterator cb, void *ptr)
+{
+	Window ret = None; ucell i;
+	winlist wins; winlist_init(&wins);
+	for (i = 0; i < stacking.depth; i++) winlist_push(&wins, stacking.items[i]);
+	for (i = wins.depth; i > 0 && cb(wins.items[i-1], ptr); i--);
+	if (i > 0) ret = wins.items[i-1];
+	winlist_free(&wins);
+	return ret;
+}
+// debug: compare against the server once the queue is drained
+void stacking_check()
+{
+	Window d1, d2, *wins = NULL; ucell num, i;
+	XSync(display, False);
+	if (XQLength(display)) return;
+	if (XQueryTree(display, root, &d1, &d2, &wins, &num))
+	{
+		for (i = 0; i < num && i < stacking.depth && wins[i] == stacking.items[i]; i++);
+		if (i < num || num != stacking.depth)
+		{
+			note("stacking mirror differs at %u (%u mirrored, %u actual), resync", i, stacking.depth, num);
+			stacking_sync();
+		}
+	}
+	if (wins) XFree(wins);
+}
 // windows
 void window_name(Window win, char *pad)
 {
@@ -545,29 +1069,152 @@ bool window_struts(Window win, ucell *l, ucell *r, ucell *t, ucell *b)
 }
 profile* profile_get(Window w)
 {
-	char name[32];
-	sprintf(name, "%u", (ucell)w);
-	return hash_get(profiles, name);
+	return table_get(profiles, w);
 }
 void profile_set(Window w, profile *p)
 {
-	char name[32];
-	sprintf(name, "%u", (ucell)w);
-	hash_set(profiles, name, p);
+	table_set(profiles, w, p);
+}
+void hook_close()
+{
+	if (hook_fd > -1) close(hook_fd);
+	hook_fd = -1; hook_pid = 0;
+}
+// sink writes never block: records are dropped while a reader is slow or absent
+bool hook_sink_ready()
+{
+	if (hook_fd < 0 && hook_fifo[0] && (hook_fd = open(hook_fifo, O_WRONLY|O_NONBLOCK)) > -1)
+		fcntl(hook_fd, F_SETFD, FD_CLOEXEC);
+	return hook_fd > -1;
 }
-void sanity_cb(hash *h, char *key, void *val)
+bool hook_sink_command(char *cmd)
 {
-	profile *p = val;
-	profile_update(p->win, 0);
+	hook_close(); hook_fifo[0] = '\0';
+	if ((hook_pid = exec_cmd_pipe(cmd, &hook_fd)) < 0)
+	{
+		hook_close();
+		return 0;
+	}
+	fcntl(hook_fd, F_SETFL, O_NONBLOCK);
+	fcntl(hook_fd, F_SETFD, FD_CLOEXEC);
+	return 1;
 }
-void hook_run(ucell hook)
+bool hook_sink_fifo(char *path)
 {
+	hook_close();
+	snprintf(hook_fifo, NOTE, "%s", path);
+	hook_sink_ready();
+	return 1;
+}
+void hook_emit(ucell hook, ulcell now)
+{
+	hookstate *h = &hooks[hook];
+	if (h->pending) hooks_pending--;
+	h->pending = 0; h->last = now;
+	if (hook_sink_ready())
+	{
+		char rec[NOTE*2];
+		int len = snprintf(rec, sizeof(rec), "%s\t%s\n", hook_names[hook], h->detail);
+		if (write(hook_fd, rec, MIN(len, sizeof(rec)-1)) < 0 && errno != EAGAIN)
+			hook_close();
+	}
 	char *cmd = hash_get(hook_commands, hook_names[hook]);
 	if (cmd) exec_cmd(cmd);
 }
-void sanity()
+void hook_run(ucell hook, char *fmt, ...)
+{
+	hookstate *h = &hooks[hook];
+	if (hook_fd < 0 && !hook_fifo[0] && !hash_find(hook_commands, hook_names[hook]))
+		return;
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(h->detail, NOTE, fmt, ap);
+	va_end(ap);
+	ulcell now = clock_ms();
+	if (h->debounce && now < h->last + h->debounce)
+	{
+		if (!h->pending) hooks_pending++;
+		h->pending = 1;
+		return;
+	}
+	hook_emit(hook, now);
+}
+// send held hooks whose interval has passed
+void hook_flush()
+{
+	int i;
+	if (!hooks_pending) return;
+	ulcell now = clock_ms();
+	for (i = 0; i < HOOK_LAST; i++)
+		if (hooks[i].pending && now >= hooks[i].last + hooks[i].debounce)
+			hook_emit(i, now);
+}
+// ms until the next held hook is due
+int hook_due(int ms)
+{
+	int i;
+	if (!hooks_pending) return ms;
+	ulcell now = clock_ms();
+	for (i = 0; i < HOOK_LAST; i++)
+		if (hooks[i].pending)
+			ms = MIN(ms, hooks[i].last + hooks[i].debounce > now
+				? (int)(hooks[i].last + hooks[i].debounce - now): 0);
+	return ms;
+}
+// deleting a property that is never set is a reply-less probe: BadWindow if gone, else nothing
+int sweep_error(Display *d, XErrorEvent *ee)
 {
-	hash_iterate(profiles, sanity_cb);
+	if (ee->error_code == BadWindow && ee->request_code == X_DeleteProperty)
+	{
+		winlist_push(&swept, ee->resourceid);
+		return 0;
+	}
+	return XWtf(d, ee);
+}
+// validate the next few profiles with one round trip
+void sweep()
+{
+	ucell n = 0; int i; slot *s;
+	if (!sweeps.cursor)
+	{
+		sweeps.cycle.depth = 0;
+		FOR_TABLE (s, profiles, i) winlist_push(&sweeps.cycle, s->key);
+	}
+	while (n < SWEEP_BATCH && sweeps.cursor < sweeps.cycle.depth)
+	{
+		Window w = sweeps.cycle.items[sweeps.cursor++];
+		// purged since the pass began
+		if (!profile_get(w)) continue;
+		XDeleteProperty(display, w, atoms[ApisSweep]);
+		n++;
+	}
+	swept.depth = 0;
+	XSetErrorHandler(sweep_error);
+	XSync(display, False);
+	XSetErrorHandler(XWtf);
+	for (i = 0; i < swept.depth; i++)
+	{
+		JOT("swept 0x%lx", swept.items[i]);
+		winlist_discard(&windows, swept.items[i]);
+		winlist_discard(&stacking, swept.items[i]);
+		profile_purge(swept.items[i]);
+	}
+	sweeps.ticks++;
+	sweeps.checked += n;
+	sweeps.purged += swept.depth;
+	if (sweeps.cursor >= sweeps.cycle.depth)
+	{
+		sweeps.cursor = 0;
+		sweeps.passes++;
+		sweeps.next = time(0) + SWEEP_PAUSE;
+	}
+}
+// ms until the next sweep is due
+int sweep_due()
+{
+	time_t now = time(0);
+	if (sweeps.cursor || sweeps.next <= now) return SWEEP_TICK;
+	return (sweeps.next - now) * 1000;
 }
 int window_get_state(Window w)
 {
@@ -596,43 +1243,46 @@ int window_get_desktop(Window w)
 	free(udata);
 	return r;
 }
+// refetch WM_TRANSIENT_FOR and move the window in the transient graph
+void profile_transient(profile *p)
+{
+	Window trans = p->trans; p->trans = None;
+	XGetTransientForHint(display, p->win, &p->trans);
+	if (trans != p->trans)
+	{
+		transient_unlink(trans, p->win);
+		transient_link(p->trans, p->win);
+	}
+}
 profile* profile_update(Window w, bool refresh)
 {
 	bool ok = 0;
-	Window lroot;
 	profile *ws = profile_get(w);
 	if (!ws)
 	{
 		ws = allocate(sizeof(profile));
 		memset(ws, 0, sizeof(profile));
-		ws->win = w; refresh = 1;
+		ws->win = w; ws->member = -1; refresh = 1;
 		profile_set(w, ws);
 	}
+	XWindowAttributes was = ws->attr;
 	if (XGetWindowAttributes(display, w, &ws->attr))
 	{
 		ok = 1;
+		// activation refreshes attributes on every keypress; only a real move or map
+		// change invalidates the focus rectangles
+		if (refresh || was.x != ws->attr.x || was.y != ws->attr.y
+			|| was.width != ws->attr.width || was.height != ws->attr.height
+			|| was.map_state != ws->attr.map_state)
+			focusrects_dirty = 1;
+		// the transient graph must stay complete, everything else waits for profile_need()
 		if (refresh)
 		{
-			ws->flags = window_get_flags(w);
-			XGetTransientForHint(display, w, &ws->trans);
-			if (ws->kids) { XFree(ws->kids); ws->kids = NULL; }
-			XQueryTree(display, w, &lroot, &ws->parent, &ws->kids, &ws->nkids);
-			window_class(w, ws->class); window_name(w, ws->name);
-			window_role(w, ws->role); window_tag(w, ws->tag);
-			ws->ewmh_type = XGetEWMHType(display, w);
-			ws->ewmh_type_name[0] = '\0';
-			if (ws->ewmh_type)
-			{
-				char *type = XGetAtomName(display, ws->ewmh_type);
-				strcpy(ws->ewmh_type_name, type); if (type) XFree(type);
-			}
-			ws->ewmh_state = XGetEWMHState(display, w);
-			ws->state = window_get_state(w);
-			ws->desktop = window_get_desktop(w);
-			window_struts(w, &ws->left, &ws->right, &ws->top, &ws->bottom);
-			if (ws->hints) { XFree(ws->hints); ws->hints = NULL; }
-			ws->hints = XGetWMHints(display, w);
+			profile_transient(ws);
+			profile_forget(ws, ~0);
 		}
+		if (refresh || was.override_redirect != ws->attr.override_redirect)
+			overhead_index(ws);
 	}
 	if (!ok)
 	{
@@ -641,9 +1291,99 @@ profile* profile_update(Window w, bool refresh)
 	}
 	return ws;
 }
+// cached profile fields backed by a property
+ucell property_fields(Atom a)
+{
+	if (a == atoms[WMName])          return PF_NAME;
+	if (a == atoms[NetWMName])       return PF_NAME;
+	if (a == XA_WM_CLASS)            return PF_CLASS;
+	if (a == atoms[WMWindowRole])    return PF_ROLE;
+	if (a == atoms[ApisTag])         return PF_TAG;
+	if (a == atoms[NetWMWindowType]) return PF_TYPE;
+	if (a == atoms[NetWMState])      return PF_EWMHSTATE;
+	if (a == atoms[WMState])         return PF_STATE;
+	if (a == atoms[NetWMDesktop])    return PF_DESKTOP;
+	if (a == atoms[NetWMStrut])      return PF_STRUTS;
+	if (a == atoms[NetWMStrutPartial]) return PF_STRUTS;
+	if (a == atoms[ApisFlags])       return PF_FLAGS;
+	if (a == XA_WM_HINTS)            return PF_HINTS;
+	return 0;
+}
+ubyte* profile_echo(profile *p, ucell bit)
+{
+	int i = 0;
+	while (i < PF_BITS-1 && !(bit & (1 << i))) i++;
+	return &p->echo[i];
+}
+// note a property write whose PropertyNotify must not drop the value just cached
+void profile_wrote(profile *p, ucell bit)
+{
+	if (p->watched) (*profile_echo(p, bit))++;
+}
+// true when a PropertyNotify only reflects one of our own writes
+bool profile_echoed(profile *p, ucell bit)
+{
+	ubyte *e = profile_echo(p, bit);
+	if (!*e) return 0;
+	(*e)--;
+	return 1;
+}
+// drop cached fields so the next profile_need() refetches them
+void profile_forget(profile *p, ucell bits)
+{
+	if (bits & PF_FOCUSABLE) focusrects_dirty = 1;
+	if (bits & (PF_IDENT|PF_TYPE)) p->rules_version = 0;
+	if (bits & PF_TYPE) bits |= PF_TYPENAME;
+	p->valid &= ~bits;
+}
+// fetch any requested fields not already cached
+profile* profile_need(profile *p, ucell bits)
+{
+	Window w = p->win;
+	if (bits & PF_TYPENAME) bits |= PF_TYPE;
+	// desktop membership is indexed from both fields together
+	if (bits & (PF_DESKTOP|PF_EWMHSTATE)) bits |= PF_DESKTOP|PF_EWMHSTATE;
+	// as is overhead, from state and type
+	if (bits & (PF_EWMHSTATE|PF_TYPE)) bits |= PF_EWMHSTATE|PF_TYPE;
+	bits &= ~p->valid;
+	if (!bits) return p;
+	if (bits & PF_FLAGS) p->flags = window_get_flags(w);
+	if (bits & PF_CLASS) window_class(w, p->class);
+	if (bits & PF_NAME)  window_name(w, p->name);
+	if (bits & PF_ROLE)  window_role(w, p->role);
+	if (bits & PF_TAG)   window_tag(w, p->tag);
+	if (bits & PF_TYPE)  p->ewmh_type = XGetEWMHType(display, w);
+	if (bits & PF_TYPENAME)
+	{
+		p->ewmh_type_name[0] = '\0';
+		if (p->ewmh_type)
+		{
+			char *type = XGetAtomName(display, p->ewmh_type);
+			if (type) { snprintf(p->ewmh_type_name, NOTE, "%s", type); XFree(type); }
+		}
+	}
+	if (bits & PF_EWMHSTATE) p->ewmh_state = XGetEWMHState(display, w);
+	if (bits & PF_STATE)   p->state = window_get_state(w);
+	if (bits & PF_DESKTOP) p->desktop = window_get_desktop(w);
+	if (bits & PF_STRUTS)
+	{
+		if (window_struts(w, &p->left, &p->right, &p->top, &p->bottom))
+		{
+			if (winlist_find(&struts, w) < 0) winlist_push(&struts, w);
+		} else winlist_discard(&struts, w);
+	}
+	if (bits & PF_HINTS)
+	{
+		if (p->hints) XFree(p->hints);
+		p->hints = XGetWMHints(display, w);
+	}
+	p->valid |= bits;
+	if (bits & (PF_DESKTOP|PF_EWMHSTATE)) desktop_index(p);
+	if (bits & (PF_EWMHSTATE|PF_TYPE)) overhead_index(p);
+	return p;
+}
 void profile_free(profile *p)
 {
-	if (p->kids) XFree(p->kids);
 	if (p->hints) XFree(p->hints);
 	free(p);
 }
@@ -652,16 +1392,22 @@ void profile_purge(Window w)
 	profile *p = profile_get(w);
 	if (p)
 	{
-		profile_free(p); char name[32];
-		sprintf(name, "%u", (ucell)w);
-		hash_del(profiles, name);
+		table_del(profiles, w);
+		focusrects_dirty = 1;
+		winlist_discard(&struts, w);
+		winlist_discard(&overhead, w);
+		if (p->member >= 0) winlist_discard(&members[p->member], w);
+		transient_unlink(p->trans, w);
+		transient_forget(w);
+		profile_free(p);
 	}
 }
 bool window_manage(profile *p)
 {
-	if (p->win == canvas || p->win == root
-		|| p->attr.override_redirect
-		|| (p->ewmh_type != None
+	if (p->win == canvas || p->win == root || p->attr.override_redirect)
+		return 0;
+	profile_need(p, PF_TYPE|PF_CLASS);
+	if ((p->ewmh_type != None
 			&& p->ewmh_type != atoms[NetWMWindowTypeNormal]
 			&& p->ewmh_type != atoms[NetWMWindowTypeUtility]
 			&& p->ewmh_type != atoms[NetWMWindowTypeToolbar]
@@ -673,7 +1419,9 @@ bool window_manage(profile *p)
 }
 bool window_visible(profile *p)
 {
-	return (p->attr.map_state == IsViewable && p->state == NormalState
+	if (p->attr.map_state != IsViewable) return 0;
+	profile_need(p, PF_STATE|PF_EWMHSTATE|PF_DESKTOP);
+	return (p->state == NormalState
 		&& !XIsEWMHState(p->ewmh_state, NetWMStateHidden)
 		&& (p->desktop == current || p->desktop == DESKTOP_ALL
 			|| XIsEWMHState(p->ewmh_state, NetWMStateSticky))
@@ -689,44 +1437,68 @@ Window window_get_active()
 		w = lastactive;
 	return w;
 }
+void window_set_active(Window w)
+{
+	if (w != netactive) hook_run(HOOK_FOCUS, "0x%lx", w);
+	XAtomSet(display, NetActiveWindow, root, XA_WINDOW, 32, &w, 1);
+	netactive = w;
+}
 void window_set_state(profile *p, int state)
 {
 	int s[2]; s[0] = state; s[1] = None;
 	XAtomSet(display, WMState, p->win, XA_CARDINAL, 32, &s, 2);
-	p->state = state;
+	p->state = state; p->valid |= PF_STATE;
+	profile_wrote(p, PF_STATE);
+	focusrects_dirty = 1;
 	if (state == NormalState)
 	{
+		profile_need(p, PF_EWMHSTATE);
 		p->ewmh_state &= ~(1 << (NetWMStateHidden - NetWMState));
 		XSetEWMHState(display, p->win, p->ewmh_state);
+		profile_wrote(p, PF_EWMHSTATE);
 	}
 }
 void window_set_flags(profile *p, ucell flag)
 {
+	profile_need(p, PF_FLAGS);
 	p->flags |= flag|WINDOW_KNOWN;
 	XAtomSet(display, ApisFlags, p->win, XA_INTEGER, 32, &p->flags, 1);
+	profile_wrote(p, PF_FLAGS);
 }
 void window_clr_flags(profile *p, ucell flag)
 {
+	profile_need(p, PF_FLAGS);
 	p->flags &= ~flag;
 	XAtomSet(display, ApisFlags, p->win, XA_INTEGER, 32, &p->flags, 1);
+	profile_wrote(p, PF_FLAGS);
 }
 void window_set_desktop(profile *p, int d)
 {
-	p->desktop = d;
+	p->desktop = d; p->valid |= PF_DESKTOP;
 	XAtomSet(display, NetWMDesktop, p->win, XA_CARDINAL, 32, &d, 1);
+	profile_wrote(p, PF_DESKTOP);
+	desktop_index(p);
 }
 void window_update_desktop(profile *p, int d)
 {
+	profile_need(p, PF_DESKTOP);
 	if (p->desktop != DESKTOP_ALL && p->desktop != d)
 		window_set_desktop(p, d);
 }
 rule* window_rule(profile *p)
 {
-	return rule_find(p->class, p->name, p->role, p->ewmh_type_name, p->tag);
+	if (p->rules_version != rules_version)
+	{
+		profile_need(p, PF_IDENT);
+		p->rule = rule_find(p->class, p->name, p->role, p->ewmh_type_name, p->tag);
+		p->rules_version = rules_version;
+	}
+	return p->rule;
 }
 rule* window_prepare(profile *p, ubyte refresh, rule *r)
 {
 	if (!r) r = window_rule(p);
+	profile_need(p, PF_FLAGS|PF_EWMHSTATE|PF_DESKTOP);
 	if (refresh || !p->flags || !(p->flags & WINDOW_KNOWN))
 	{
 		ucell nflags = r && r->rflags & RULE_MASK
@@ -741,9 +1513,12 @@ rule* window_prepare(profile *p, ubyte refresh, rule *r)
 		}
 		nflags &= ~WINDOW_CONFIG;
 		window_set_flags(p, nflags);
+		if (r) hook_run(HOOK_RULE, "0x%lx\t%s", p->win, r->class);
 		ucell props = nflags >> WINDOW_STATE_RANGE;
 		XSetEWMHState(display, p->win, props);
-		p->ewmh_state = props;
+		p->ewmh_state = props; p->valid |= PF_EWMHSTATE;
+		profile_wrote(p, PF_EWMHSTATE);
+		overhead_index(p);
 		if (p->desktop == DESKTOP_NONE) p->desktop = current;
 		if (r && r->rflags & RULE_DESKTOP && r->desktop > DESKTOP_NONE) p->desktop = r->desktop;
 		window_set_desktop(p, p->desktop);
@@ -755,134 +1530,117 @@ void window_track(profile *p)
 	winlist_discard(&windows, p->win);
 	winlist_push(&windows, p->win);
 	XSelectInput(display, p->win, PropertyChangeMask | EnterWindowMask | LeaveWindowMask | FocusChangeMask);
+	p->watched = 1;
 }
-void window_raise_kids(Window w, Window except, Window *wins, ucell num, Window *trans, winlist *local, ubyte *used, ubyte *attrok, ubyte *view, ubyte *manage)
+// transients of w already on the raise list, recursively
+void window_raise_kids(Window w, Window except, winlist *local)
 {
-	int i;
-	for (i = 0; i < num; i++)
+	winlist *kids = table_get(transients, w);
+	if (!kids) return;
+	// profile_update() may purge and unlink, so walk a copy
+	winlist copy; winlist_init(&copy);
+	int i; for (i = 0; i < kids->depth; i++) winlist_push(&copy, kids->items[i]);
+	for (i = 0; i < copy.depth; i++)
 	{
-		// locate main window transients
-		if (wins[i] != except && !bm_chk(used, i) && bm_chk(attrok, i) && bm_chk(view, i))
+		Window k = copy.items[i]; profile *p;
+		if (k != except && winlist_find(local, k) < 0 && (p = profile_update(k, 0))
+			&& p->attr.map_state == IsViewable && window_manage(p))
 		{
-			if (bm_chk(manage, i) && trans[i] == w)
-			{
-				winlist_push(local, wins[i]); bm_set(used, i);
-				window_raise_kids(wins[i], except, wins, num, trans, local, used, attrok, view, manage);
-			}
+			winlist_push(local, k);
+			window_raise_kids(k, except, local);
 		}
 	}
+	winlist_free(&copy);
 }
 void window_raise(profile *p)
 {
-	Window w = p->win;
+	Window w = p->win, wtrans;
 	winlist local; winlist_init(&local);
 	winlist list;  winlist_init(&list);
 	winlist above; winlist_init(&above);
-	Window super, parent, *wins = NULL; ucell num; int i;
-	if (XQueryTree(display, root, &super, &parent, &wins, &num) && wins && num)
-	{
-		Window wtrans = None; int windex = -1, wtransindex = -1;
-		XWindowAttributes *attr = allocate(sizeof(XWindowAttributes) * num);
-		// map of transient relationships
-		Window *trans = allocate(sizeof(Window) * num);
-		// bit map of windows already in the stack list (double ups cause BadWindow)
-		ubyte *used = bm_create(num);
-		// bit map of XGetWindowAttributes success
-		ubyte *attrok = bm_create(num);
-		// bit map of manage flags
-		ubyte *manage = bm_create(num);
-		// bit map of viewable windows
-		ubyte *view = bm_create(num);
-		ucell *states = allocate(sizeof(ucell) * num);
-		int *desktops = allocate(sizeof(int) * num);
-		ucell *types = allocate(sizeof(ucell) * num);
-		// build window associations
-		for (i = 0; i < num; i++)
-		{
-			trans[i] = None;
-			profile *p = profile_update(wins[i], 0);
-			if (p)
+	profile *t = NULL; int i;
+	if ((p = profile_update(w, 0)) && winlist_find(&stacking, w) > -1)
+	{
+		wtrans = p->trans;
+		if (wtrans != None && (winlist_find(&stacking, wtrans) < 0 || !(t = profile_update(wtrans, 0))))
+			wtrans = None;
+		if (wtrans != None)
+		{
+			// the raised transient stays topmost among its siblings
+			winlist *kids = table_get(transients, wtrans);
+			if (kids && winlist_find(kids, w) > -1)
 			{
-				bm_set(attrok, i);
-				memmove(&attr[i], &p->attr, sizeof(XWindowAttributes));
-				trans[i] = p->trans;
-				states[i] = p->ewmh_state;
-				desktops[i] = p->desktop;
-				types[i] = p->ewmh_type;
-				if (p && window_manage(p))
-					bm_set(manage, i);
-				if (attr[i].map_state == IsViewable)
-					bm_set(view, i);
-				if (wins[i] == w)
-				{
-					windex = i;
-					wtrans = trans[i];
-				}
+				winlist_discard(kids, w);
+				winlist_push(kids, w);
 			}
+			winlist_push(&local, wtrans);
+			window_raise_kids(wtrans, w, &local);
 		}
-		if (windex > -1)
+		winlist_push(&local, w);
+		window_raise_kids(w, None, &local);
+		// the few windows that should be above everything else, topmost first
+		// (cached profiles: map state is refreshed by Map/UnmapNotify)
+		stackpos *pos = allocate(sizeof(stackpos) * (overhead.depth + 1));
+		int k = 0, at;
+		// downward, as profile_need() may drop the current member
+		for (i = overhead.depth-1; i > -1; i--)
 		{
-			if (wtrans != None)
-			{
-				for (i = 0; i < num; i++)
-					if (wins[i] == wtrans) wtransindex = i;
-				if (wtransindex < 0) wtrans = None;
-			}
-			if (wtrans != None)
-			{
-				winlist_push(&local, wtrans); bm_set(used, wtransindex);
-				window_raise_kids(wtrans, w, wins, num, trans, &local, used, attrok, view, manage);
-			}
-			winlist_push(&local, w); bm_set(used, windex);
-			window_raise_kids(w, None, wins, num, trans, &local, used, attrok, view, manage);
-			for (i = 0; i < num; i++)
+			profile *o = profile_get(overhead.items[i]);
+			if (!o || o->attr.map_state != IsViewable || winlist_find(&local, o->win) > -1
+				|| (at = winlist_find(&stacking, o->win)) < 0)
+				continue;
+			profile_need(o, PF_EWMHSTATE|PF_TYPE|PF_DESKTOP);
+			if (!window_overhead(o)) continue;
+			// don't want any managed window that belongs exclusively to another desktop
+			if (XIsEWMHState(o->ewmh_state, NetWMStateSticky) || o->desktop == current
+				|| o->desktop == DESKTOP_ALL || o->desktop == DESKTOP_NONE)
 			{
-				// find all _NET_WM_STATE_ABOVE, override_redirect, docks, panels
-				if (!bm_chk(used, i) && bm_chk(attrok, i) && bm_chk(view, i))
-				{
-					if ( // want any window that should be above everything else
-						(attr[i].override_redirect || XIsEWMHState(states[i], NetWMStateAbove)
-							|| (types[i] == atoms[NetWMWindowTypeDock]
-								&& !XIsEWMHState(states[i], NetWMStateBelow)))
-						// don't want any managed window that belongs exclusively to another desktop
-						&& (XIsEWMHState(states[i], NetWMStateSticky) || desktops[i] == current
-							|| desktops[i] == DESKTOP_ALL || desktops[i] == DESKTOP_NONE))
-					{
-						winlist_push(&above, wins[i]);
-						bm_set(used, i);
-					}
-				}
+				pos[k].index = at; pos[k].win = o->win; k++;
 			}
-			if (XIsEWMHState(states[windex], NetWMStateAbove)
-				|| (wtrans != None && XIsEWMHState(states[wtransindex], NetWMStateAbove)))
-				while (local.depth) winlist_push(&list, winlist_pop(&local));
-			while (above.depth) winlist_push(&list, winlist_pop(&above));
-			while (local.depth) winlist_push(&list, winlist_pop(&local));
-			XRaiseWindow(display, list.items[0]);
-			XRestackWindows(display, list.items, list.depth);
 		}
-		if (wins) XFree(wins);
-		free(trans); free(attr);
-		free(used); free(attrok); free(manage); free(view);
-		free(states); free(desktops); free(types);
+		qsort(pos, k, sizeof(stackpos), stackpos_cmp);
+		for (i = 0; i < k; i++) winlist_push(&above, pos[i].win);
+		free(pos);
+		if (XIsEWMHState(profile_need(p, PF_EWMHSTATE)->ewmh_state, NetWMStateAbove)
+			|| (t && XIsEWMHState(profile_need(t, PF_EWMHSTATE)->ewmh_state, NetWMStateAbove)))
+			while (local.depth) winlist_push(&list, winlist_pop(&local));
+		for (i = 0; i < above.depth; i++) winlist_push(&list, above.items[i]);
+		while (local.depth) winlist_push(&list, winlist_pop(&local));
+		XRaiseWindow(display, list.items[0]);
+		XRestackWindows(display, list.items, list.depth);
+		stacking_raise(list.items[0]);
+		stacking_restack(list.items, list.depth);
 	}
 	winlist_free(&above); winlist_free(&list); winlist_free(&local);
 }
 void window_focus(profile *p)
 {
+	profile_need(p, PF_HINTS);
 	Bool input = (p->hints && p->hints->flags & InputHint) ? p->hints->input: True;
 	XSetInputFocus(display, input ? p->win: root, RevertToNone, CurrentTime);
-	XAtomSet(display, NetActiveWindow, root, XA_WINDOW, 32, &p->win, 1);
+	window_set_active(p->win);
 	lastactive = p->win;
 }
 void window_check_visible(profile *p)
 {
 }
+// the grid box a tiled window at x,y,w,h snaps to. its central half decides first
+box* window_snap_box(profile *p, int x, int y, int w, int h)
+{
+	box *f = NULL;
+	profile_need(p, PF_FLAGS|PF_DESKTOP);
+	if (!(p->flags & WINDOW_TILED)) return NULL;
+	grid *g = grids[p->desktop < 0 ? current: p->desktop];
+	if (!(f = grid_box_by_region(g, x+(w/4), y+(h/4), w/2, h/2)))
+		f = grid_box_by_region(g, x, y, w, h);
+	return f;
+}
 box* window_configure(profile *p, ucell mask, int x, int y, int w, int h, int b, rule *r, winlist *sibs)
 {
 	box *f = NULL;
-	if (p->win == drag_win) return NULL;
+	if (p->win == drag.win) return NULL;
 	if (!r) r = window_rule(p);
+	profile_need(p, PF_FLAGS|PF_DESKTOP|PF_EWMHSTATE|PF_TYPE);
 	if (!(mask & CWX)) x = p->attr.x; if (!(mask & CWY)) y = p->attr.y;
 	if (!(mask & CWWidth)) w = p->attr.width; if (!(mask & CWHeight)) h = p->attr.height;
 	if (!(mask & CWBorderWidth)) b = 0;
@@ -948,10 +1706,7 @@ box* window_configure(profile *p, ucell mask, int x, int y, int w, int h, int b,
 		}
 		window_set_flags(p, WINDOW_CONFIG);
 		bool center = 0; int border = b;
-		int desktop = p->desktop < 0 ? current: p->desktop;
-		if (p->flags & WINDOW_TILED && (
-			(f = grid_box_by_region(grids[desktop], x+(w/4), y+(h/4), w/2, h/2)) != NULL
-			|| (f = grid_box_by_region(grids[desktop], x, y, w, h)) != NULL))
+		if ((f = window_snap_box(p, x, y, w, h)) != NULL)
 		{
 			x = f->x+pad_left; y = f->y+pad_top;
 			w = f->w-(border*2); h = f->h-(border*2);
@@ -1007,25 +1762,40 @@ void window_iconify(profile *p)
 // ewmh
 ubyte ewmh_cb(Window win, void *ptr)
 {
-	profile *p = profile_update(win, 0);
-	if (p && window_manage(p) && p->state != WithdrawnState
+	profile *p = profile_get(win);
+	if (p && window_manage(p) && profile_need(p, PF_STATE|PF_EWMHSTATE)->state != WithdrawnState
 		&& !(XIsEWMHState(p->ewmh_state, NetWMStateSkipTaskbar)
 			|| XIsEWMHState(p->ewmh_state, NetWMStateSkipPager)
 			|| XIsEWMHState(p->ewmh_state, NetWMStateHidden))
 		) winlist_push(ptr, win);
 	return 1;
 }
+// client lists are rebuilt from cached profiles once the event queue drains
 void ewmh_windows()
+{
+	ewmh_dirty = 1;
+}
+bool ewmh_list_same(winlist *a, winlist *b)
+{
+	return a->depth == b->depth && !memcmp(a->items, b->items, sizeof(Window) * a->depth);
+}
+void ewmh_flush()
 {
 	int i;
+	if (!ewmh_dirty) return;
+	ewmh_dirty = 0;
 	winlist stacked; winlist_init(&stacked);
-	XIterateChildren(display, root, ewmh_cb, &stacked);
-	XAtomSet(display, NetClientListStacking, root, XA_WINDOW, 32, stacked.items, stacked.depth);
+	for (i = 0; i < stacking.depth; i++)
+		ewmh_cb(stacking.items[i], &stacked);
+	if (!ewmh_list_same(&stacked, &ewmh_stacked))
+		XAtomSet(display, NetClientListStacking, root, XA_WINDOW, 32, stacked.items, stacked.depth);
 	winlist clients; winlist_init(&clients);
 	for (i = 0; i < windows.depth; i++)
 		ewmh_cb(windows.items[i], &clients);
-	XAtomSet(display, NetClientList, root, XA_WINDOW, 32, clients.items, clients.depth);
-	winlist_free(&stacked); winlist_free(&clients);
+	if (!ewmh_list_same(&clients, &ewmh_clients))
+		XAtomSet(display, NetClientList, root, XA_WINDOW, 32, clients.items, clients.depth);
+	winlist_free(&ewmh_stacked); winlist_free(&ewmh_clients);
+	ewmh_stacked = stacked; ewmh_clients = clients;
 }
 void ewmh_desktops()
 {
@@ -1057,25 +1827,74 @@ void ewmh()
 ubyte desktop_rescue(Window w, void *ptr)
 {
 	profile *p = profile_update(w, 0);
-	if (p && p->desktop >= desktops) window_set_desktop(p, current);
-	return 1;
-}
-ubyte desktop_raise_cb(Window w, void *ptr)
-{
-	profile *p = profile_update(w, 0);
-	if (p && window_visible(p) && window_manage(p))
-		winlist_push(ptr, w);
+	if (p && profile_need(p, PF_DESKTOP)->desktop >= desktops) window_set_desktop(p, current);
 	return 1;
 }
+// keep p on the members[] list for its desktop
+void desktop_index(profile *p)
+{
+	int m = -1;
+	focusrects_dirty = 1;
+	// a no-op from inside profile_need(), which fetches both fields at once
+	profile_need(p, PF_DESKTOP|PF_EWMHSTATE);
+	if (p->desktop == DESKTOP_ALL || XIsEWMHState(p->ewmh_state, NetWMStateSticky))
+		m = MEMBERS_SHARED;
+	else
+	if (p->desktop >= 0 && p->desktop < MAX_DESKTOPS)
+		m = p->desktop;
+	if (m == p->member) return;
+	if (p->member >= 0) winlist_discard(&members[p->member], p->win);
+	if (m >= 0) winlist_push(&members[m], p->win);
+	p->member = m;
+}
+// topmost first
+int stackpos_cmp(const void *a, const void *b)
+{
+	return ((stackpos*)b)->index - ((stackpos*)a)->index;
+}
+// from cached fields only; state and type are unknown until profile_need() fetches them
+bool window_overhead(profile *p)
+{
+	return p->attr.override_redirect
+		|| ((p->valid & (PF_EWMHSTATE|PF_TYPE)) == (PF_EWMHSTATE|PF_TYPE)
+			&& (XIsEWMHState(p->ewmh_state, NetWMStateAbove)
+				|| (p->ewmh_type == atoms[NetWMWindowTypeDock]
+					&& !XIsEWMHState(p->ewmh_state, NetWMStateBelow)))) ?1:0;
+}
+// membership waits while state and type are unknown. profile_need() fetches them
+// together and calls this again, and window_raise() rechecks each member
+void overhead_index(profile *p)
+{
+	if (!p->attr.override_redirect && (p->valid & (PF_EWMHSTATE|PF_TYPE)) != (PF_EWMHSTATE|PF_TYPE))
+		return;
+	bool above = window_overhead(p);
+	int at = winlist_find(&overhead, p->win);
+	if (above && at < 0) winlist_push(&overhead, p->win);
+	if (!above && at > -1) winlist_del(&overhead, at);
+}
+// windows on other desktops stay under the canvas, so only incoming members move
 void desktop_raise(int d)
 {
-	current = d;
+	current = d; focusrects_dirty = 1;
+	if (grid_fit(d))
+		desktop_configure(d);
+	int i;
+	// one walk down the mirror picks the incoming members topmost first, as
+	// XRestackWindows wants, with the canvas under them all
 	winlist raise; winlist_init(&raise);
+	for (i = stacking.depth-1; i > -1; i--)
+	{
+		profile *p = profile_get(stacking.items[i]);
+		if (p && (p->member == d || p->member == MEMBERS_SHARED)
+			&& window_visible(p) && window_manage(p))
+			winlist_push(&raise, p->win);
+	}
 	winlist_push(&raise, canvas);
-	XIterateChildren(display, root, desktop_raise_cb, &raise);
-	int i; for (i = 0; i < raise.depth; i++)
-		XRaiseWindow(display, raise.items[i]);
-	window_raise(profile_update(raise.items[raise.depth-1], 0));
+	XRaiseWindow(display, raise.items[0]);
+	XRestackWindows(display, raise.items, raise.depth);
+	stacking_raise(raise.items[0]);
+	stacking_restack(raise.items, raise.depth);
+	window_raise(profile_update(raise.items[0], 0));
 	window_activate_last();
 	winlist_free(&raise);
 }
@@ -1083,7 +1902,8 @@ bool desktop_refresh_cb(Window w, void *ptr)
 {
 	int d = *((int*)ptr);
 	profile *p = profile_update(w, 0);
-	if (p && window_manage(p) && (p->desktop == d || (d == current &&
+	if (p && window_manage(p) && profile_need(p, PF_DESKTOP|PF_EWMHSTATE)
+		&& (p->desktop == d || (d == current &&
 			(p->desktop == DESKTOP_ALL || XIsEWMHState(p->ewmh_state, NetWMStateSticky))
 		)))
 		window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
@@ -1091,12 +1911,12 @@ bool desktop_refresh_cb(Window w, void *ptr)
 }
 void desktop_configure(int d)
 {
-	XIterateChildren(display, root, desktop_refresh_cb, &d);
+	stacking_iterate(desktop_refresh_cb, &d);
 }
 bool update_struts_cb(Window w, void *ptr)
 {
-	profile *p = profile_update(w, 0);
-	if (p && window_visible(p))
+	profile *p = profile_get(w);
+	if (p && p->attr.map_state == IsViewable && window_visible(p))
 	{
 		pad_left   = MAX(p->left,   pad_left);
 		pad_right  = MAX(p->right,  pad_right);
@@ -1112,7 +1932,10 @@ void update_struts()
 {
 	bool ok = 0;
 	pad_left = 0, pad_right = 0, pad_top = 0, pad_bottom = 0;
-	XIterateChildren(display, root, update_struts_cb, NULL);
+	screen_x = 0; screen_y = 0;
+	screen_width = screen->width; screen_height = screen->height;
+	int i; for (i = 0; i < struts.depth; i++)
+		update_struts_cb(struts.items[i], NULL);
 	ok = grid_adjust(grids[current], screen_width, screen_height);
 	grid_snapshot(grids[current], current);
 	desktop_configure(current);
@@ -1131,56 +1954,91 @@ void window_activate(profile *p, bool refresh)
 }
 void window_activate_last()
 {
-	Window none = None;
-	XAtomSet(display, NetActiveWindow, root, XA_WINDOW, 32, &none, 1);
-	Window d1, d2, *wins = NULL; ucell num; int i = -1;
-	if (XQueryTree(display, root, &d1, &d2, &wins, &num))
+	window_set_active(None);
+	int i;
+	for (i = stacking.depth-1; i > -1; i--)
 	{
-		for (i = num-1; i > -1; i--)
+		profile *p = profile_get(stacking.items[i]);
+		if (p && window_visible(p) && window_manage(p)
+			&& (p->ewmh_type == 0 || p->ewmh_type == atoms[NetWMWindowTypeNormal]
+				|| p->ewmh_type == atoms[NetWMWindowTypeDialog]))
 		{
-			profile *p = profile_update(wins[i], 0);
-			if (p && window_visible(p) && window_manage(p)
-				&& (p->ewmh_type == 0 || p->ewmh_type == atoms[NetWMWindowTypeNormal]
-					|| p->ewmh_type == atoms[NetWMWindowTypeDialog]))
-			{
-				window_activate(p, 1);
-				break;
-			}
+			window_activate(p, 1);
+			break;
 		}
-		if (wins) XFree(wins);
 	}
 	if (i == -1) XSetInputFocus(display, root, RevertToNone, CurrentTime);
 }
+bool window_focusable(profile *p)
+{
+	return window_visible(p) && window_manage(p)
+		&& (!p->ewmh_type || p->ewmh_type == atoms[NetWMWindowTypeNormal])
+		&& !(XIsEWMHState(p->ewmh_state, NetWMStateSkipTaskbar)
+			|| XIsEWMHState(p->ewmh_state, NetWMStateSkipPager)
+			|| XIsEWMHState(p->ewmh_state, NetWMStateHidden));
+}
+// only the current desktop's members can be focusable
+void focusrects_rebuild()
+{
+	winlist *sets[2] = { &members[current], &members[MEMBERS_SHARED] };
+	int i, j;
+	focusrects_count = 0;
+	for (j = 0; j < 2; j++)
+	for (i = 0; i < sets[j]->depth; i++)
+	{
+		profile *p = profile_get(sets[j]->items[i]);
+		if (!p || !window_focusable(p)) continue;
+		if (focusrects_count == focusrects_limit)
+		{
+			focusrects_limit = focusrects_limit ? focusrects_limit * 2: STACK;
+			focusrects = reallocate(focusrects, sizeof(focusrect) * focusrects_limit);
+		}
+		focusrect *r = &focusrects[focusrects_count++];
+		r->win = p->win; r->x = p->attr.x; r->y = p->attr.y;
+		r->w = p->attr.width; r->h = p->attr.height;
+	}
+	focusrects_dirty = 0;
+}
+// topmost focusable window overlapping the region
 Window window_by_region(int x, int y, int w, int h, Window except)
 {
-	Window nearest = None; //ucell overlap = 0;
-	Window d1, d2, *wins = NULL; ucell num; int i;
-	if (XQueryTree(display, root, &d1, &d2, &wins, &num))
+	Window nearest = None; int i;
+	if (focusrects_dirty) focusrects_rebuild();
+	winlist hits; winlist_init(&hits);
+	for (i = 0; i < focusrects_count; i++)
+	{
+		focusrect *r = &focusrects[i];
+		if (r->win != except
+			&& region_overlap_x(r->x, r->y, r->w, r->h, x, y, w, h)
+			&& region_overlap_y(r->x, r->y, r->w, r->h, x, y, w, h))
+			winlist_push(&hits, r->win);
+	}
+	// stacking order only matters between overlapping hits
+	if (hits.depth == 1)
+		nearest = hits.items[0];
+	else
+	for (i = stacking.depth-1; i > -1 && hits.depth > 1; i--)
 	{
-		for (i = num-1; i > -1; i--)
+		if (winlist_find(&hits, stacking.items[i]) > -1)
 		{
-			if (wins[i] == except) continue;
-			profile *p = profile_update(wins[i], 0);
-			if (p && window_visible(p) && window_manage(p))
-			{
-				if (p->ewmh_type && p->ewmh_type != atoms[NetWMWindowTypeNormal]) continue;
-				if (XIsEWMHState(p->ewmh_state, NetWMStateSkipTaskbar)
-					|| XIsEWMHState(p->ewmh_state, NetWMStateSkipPager)
-					|| XIsEWMHState(p->ewmh_state, NetWMStateHidden)) continue;
-				bool overlap_x = region_overlap_x(p->attr.x, p->attr.y, p->attr.width, p->attr.height, x, y, w, h);
-				bool overlap_y = region_overlap_y(p->attr.x, p->attr.y, p->attr.width, p->attr.height, x, y, w, h);
-				if (overlap_x && overlap_y)
-				{
-					nearest = wins[i];
-					break;
-				}
-			}
+			nearest = stacking.items[i];
+			break;
 		}
-		if (wins) XFree(wins);
 	}
+	winlist_free(&hits);
 	return nearest;
 }
 //controls
+command* command_find(char *name)
+{
+	int i = PHASH_FIND(name, apis_commands);
+	return i < 0 ? NULL: &commands[i];
+}
+struct name_to_flag* flag_find(char *name)
+{
+	int i = PHASH_FIND(name, apis_flags);
+	return i < 0 ? NULL: &names_to_flags[i];
+}
 bool parse_flags_type(hash *args, char *name, ucell *f)
 {
 	bool ok = 0;
@@ -1194,7 +2052,7 @@ bool parse_flags_type(hash *args, char *name, ucell *f)
 		{
 			char *name = strnextthese(&s, ",");
 			struct name_to_flag *nf = NULL;
-			if (name && (nf = hash_get(flagnames, name)) != NULL)
+			if (name && (nf = flag_find(name)) != NULL)
 				flags |= nf->flag;
 			strskipthese(&s, ","); free(name);
 		}
@@ -1253,9 +2111,8 @@ bool parse_int(hash *args, char *name, int *r)
 	}
 	return 0;
 }
-bool op_split(char *in, autostr *out)
+bool op_split(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	char *direction = parse_direction(args);
 	dcell n = 0.5; regmatch_t subs[10];
 	char *ratio = hash_expect(args, "ratio", "^([0-9]+)/([0-9]+)$", 10, subs);
@@ -1278,12 +2135,10 @@ bool op_split(char *in, autostr *out)
 		desktop_configure(current);
 		grid_configure(g);
 	}
-	hash_free(args, 1);
 	return ok;
 }
-bool op_size(char *in, autostr *out)
+bool op_size(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	grid *g = grids[current];
 	int bn; if (!parse_int(args, "box", &bn)) bn = g->active;
 	box *b = &g->boxes[MIN(g->count-1, MAX(0, bn))];
@@ -1302,12 +2157,10 @@ bool op_size(char *in, autostr *out)
 		desktop_configure(current);
 		grid_configure(g);
 	}
-	hash_free(args, 1);
 	return ok;
 }
-bool op_remove(char *in, autostr *out)
+bool op_remove(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	grid *g = grids[current];
 	int bn; if (!parse_int(args, "box", &bn)) bn = g->active;
 	bool ok = grid_remove(g, MIN(g->count-1, MAX(0, bn)));
@@ -1317,12 +2170,10 @@ bool op_remove(char *in, autostr *out)
 		desktop_configure(current);
 		grid_configure(g);
 	}
-	hash_free(args, 1);
 	return ok;
 }
-bool op_overlay(char *in, autostr *out)
+bool op_overlay(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	ubyte mode = parse_mode(args);
 	grid *g = grids[current];
 	ubyte ok = 0;
@@ -1336,7 +2187,6 @@ bool op_overlay(char *in, autostr *out)
 			ok = 1;
 		}
 	}
-	hash_free(args, 1);
 	if (ok) grid_snapshot(g, current);
 	return ok;
 }
@@ -1402,13 +2252,12 @@ rule* parse_rule(hash *args)
 	if (hash_find(args, "focus"))  rflags |= RULE_FOCUS;
 	return rule_create(rflags, class, name, role, type, tag, d, setflags, clrflags, flipflags, x, y, w, h, f, cols, rows);
 }
-bool op_rule(char *in, autostr *out)
+bool op_rule(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	if (hash_find_one(args, "empty"))
 	{
 		while (rules->depth > 0)
-			free(stack_pop(rules));
+			rule_remove(stack_top(rules));
 		return 1;
 	}
 	ubyte mode = parse_mode(args);
@@ -1418,46 +2267,59 @@ bool op_rule(char *in, autostr *out)
 		&& (mode == 1 || mode == 2))
 	{
 		rule *old = rule_find(r->class, r->name, r->role, r->type, r->tag);
-		if (old)
-		{
-			stack_discard(rules, old);
-			free(old);
-		}
-		if (mode == 1) stack_push(rules, r);
-		else free(r);
+		if (old) rule_remove(old);
+		if (mode == 1) rule_add(r);
+		else rule_free(r);
 		ok = 1;
 	}
-	hash_free(args, 1);
 	return ok;
 }
-bool op_hook(char *in, autostr *out)
+bool op_hook(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	int i; char **name;
 	if (hash_find_one(args, "empty"))
 	{
 		FOR_ARRAY (name, hook_names, char*, i)
 			free(hash_del(hook_commands, *name));
+		hook_close(); hook_fifo[0] = '\0';
 		return 1;
 	}
 	ubyte ok = 0;
 	ubyte mode = parse_mode(args);
 	char *event = hash_expect(args, "event", "^[a-z_]+$", 0, NULL);
 	char *exec = hash_expect(args, "execute", ".+", 0, NULL);
-	if (event && (mode == 1 || mode == 2))
+	char *sink = hash_expect(args, "sink", ".+", 0, NULL);
+	char *fifo = hash_expect(args, "fifo", ".+", 0, NULL);
+	int debounce;
+	// one sink for all events
+	if ((sink || fifo) && mode == 1)
+		return sink ? hook_sink_command(sink): hook_sink_fifo(fifo);
+	if ((hash_find(args, "sink") || hash_find(args, "fifo")) && mode == 2)
+	{
+		hook_close(); hook_fifo[0] = '\0';
+		return 1;
+	}
+	if (event)
 	{
 		FOR_ARRAY (name, hook_names, char*, i)
 		{
 			if (strcmp(*name, event) == 0)
 			{
-				free(hash_del(hook_commands, event));
-				if (mode == 1) hash_set(hook_commands, event, strdup(exec));
-				ok = 1;
+				if (parse_int(args, "debounce", &debounce))
+				{
+					hooks[i].debounce = MAX(0, debounce);
+					ok = 1;
+				}
+				if ((mode == 1 && exec) || mode == 2)
+				{
+					free(hash_del(hook_commands, event));
+					if (mode == 1) hash_set(hook_commands, event, strdup(exec));
+					ok = 1;
+				}
 				break;
 			}
 		}
 	}
-	hash_free(args, 1);
 	return ok;
 }
 bool op_config_cb(Window w, void *ptr)
@@ -1465,7 +2327,7 @@ bool op_config_cb(Window w, void *ptr)
 	struct rule_iter *ri = ptr;
 	profile *p = profile_update(w, 0);
 	if (p && window_visible(p) && window_manage(p)
-		&& rule_match(ri->rule, p->class, p->name, p->role, p->ewmh_type_name, p->tag))
+		&& profile_need(p, PF_IDENT) && rule_match(ri->rule, p->class, p->name, p->role, p->ewmh_type_name, p->tag))
 	{
 		window_prepare(p, 1, ri->rule);
 		window_configure(p, 0, 0, 0, 0, 0, 0, ri->rule, &ri->siblings);
@@ -1475,9 +2337,8 @@ bool op_config_cb(Window w, void *ptr)
 	}
 	return 1;
 }
-bool op_config(char *in, autostr *out)
+bool op_config(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	rule *r = parse_rule(args);
 	ubyte ok = 0;
 	if (r)
@@ -1494,12 +2355,11 @@ bool op_config(char *in, autostr *out)
 		} else
 		{
 			struct rule_iter ri; ri.rule = r; winlist_init(&ri.siblings);
-			XIterateChildrenBack(display, root, op_config_cb, &ri);
+			stacking_iterate_back(op_config_cb, &ri);
 			ok = 1; winlist_free(&ri.siblings);
 		}
-		free(r);
+		rule_free(r);
 	}
-	hash_free(args, 1);
 	ewmh_windows();
 	return ok;
 }
@@ -1508,16 +2368,15 @@ bool op_reset_cb(Window w, void *ptr)
 	rule *r = ptr;
 	profile *p = profile_update(w, 0);
 	if (p && window_visible(p) && window_manage(p)
-		&& rule_match(r, p->class, p->name, p->role, p->ewmh_type_name, p->tag))
+		&& profile_need(p, PF_IDENT) && rule_match(r, p->class, p->name, p->role, p->ewmh_type_name, p->tag))
 	{
 		window_prepare(p, 1, NULL);
 		window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
 	}
 	return 1;
 }
-bool op_reset(char *in, autostr *out)
+bool op_reset(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	rule *r = parse_rule(args);
 	ubyte ok = 0;
 	if (r)
@@ -1532,15 +2391,20 @@ bool op_reset(char *in, autostr *out)
 			}
 		} else
 		{
-			XIterateChildren(display, root, op_reset_cb, r);
+			stacking_iterate(op_reset_cb, r);
 			ok = 1;
 		}
-		free(r);
+		rule_free(r);
 	}
-	hash_free(args, 1);
 	ewmh_windows();
 	return ok;
 }
+void op_show_sweep(autostr *out)
+{
+	str_print(out, NOTE, "profiles %u passes %u ticks %u checked %u purged %u cursor %u/%u\n",
+		profiles->count, sweeps.passes, sweeps.ticks, sweeps.checked, sweeps.purged,
+		sweeps.cursor, sweeps.cycle.depth);
+}
 void op_show_rules(autostr *out)
 {
 	int i; rule *r;
@@ -1555,22 +2419,24 @@ void op_show_rules(autostr *out)
 void op_show_grid(autostr *out)
 {
 	box *b; int i; grid *g = grids[current];
-	FOR_ARRAY_PART (b, g->boxes, box, i, g->count)
+	FOR_BOXES (b, g, i)
 		str_print(out, NOTE, "%d %s %d %d %d %d\n", i, i == g->active ? "*": "-", b->x, b->y, b->w, b->h);
 }
 void op_show_hooks(autostr *out)
 {
 	int i; char **name;
+	if (hook_fifo[0]) str_print(out, NOTE, "fifo: %s%s\n", hook_fifo, hook_fd > -1 ? "": " (no reader)");
+	else if (hook_fd > -1) str_print(out, NOTE, "sink: pid %d\n", hook_pid);
 	FOR_ARRAY (name, hook_names, char*, i)
 	{
 		char *cmd = hash_get(hook_commands, *name);
 		if (cmd) str_print(out, NOTE, "%s: %s\n", *name, cmd);
+		if (hooks[i].debounce) str_print(out, NOTE, "%s: debounce %ums\n", *name, hooks[i].debounce);
 	}
 }
-bool op_show(char *in, autostr *out)
+bool op_show(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
-	char *type = hash_expect(args, "type", "^(rules|grid|hooks)$", 0, NULL);
+	char *type = hash_expect(args, "type", "^(rules|grid|hooks|sweep)$", 0, NULL);
 	bool ok = 0;
 	if (type)
 	{
@@ -1582,18 +2448,19 @@ bool op_show(char *in, autostr *out)
 		else
 		if (strcmp(type, "hooks") == 0)
 			op_show_hooks(out);
+		else
+		if (strcmp(type, "sweep") == 0)
+			op_show_sweep(out);
 		ok = 1;
 	}
-	hash_free(args, 1);
 	return ok;
 }
-bool op_focus(char *in, autostr *out)
+bool op_focus(hash *args, autostr *out)
 {
-	hash *args = hash_decode(in);
 	char *dir = hash_expect(args, "direction", "^(left|right|up|down)$", 0, NULL);
 	bool ok = 0;
 	Window active = window_get_active(), next = None; profile *p = NULL;
-	if (dir && active != None && active != root && (p = profile_update(active, 0)) != NULL)
+	if (dir && active != None && active != root && (p = profile_get(active)) != NULL)
 	{
 		int x = p->attr.x, y = p->attr.y, w = p->attr.width, h = p->attr.height;
 		if (*dir == 'l')
@@ -1609,13 +2476,12 @@ bool op_focus(char *in, autostr *out)
 			if ((next = window_by_region(x, y + h, w, screen_height - y - h, active)) == None)
 				next = window_by_region(0, y + h, screen_width, screen_height - y - h, active);
 		profile *np;
-		if (next != None && (np = profile_update(next, 0)) != NULL)
+		if (next != None && (np = profile_get(next)) != NULL)
 		{
 			window_activate(np, 1);
 			ok = 1;
 		}
 	}
-	hash_free(args, 1);
 	return ok;
 }
 void grabs()
@@ -1629,6 +2495,95 @@ void event_KeyPress(XEvent *e)
 void event_KeyRelease(XEvent *e)
 {
 }
+void drag_start(profile *p, XButtonEvent *be)
+{
+	long userhints; int i;
+	drag.win = p->win;
+	drag.x = be->x_root; drag.y = be->y_root; drag.button = be->button;
+	drag.attr = p->attr;
+	drag.tx = p->attr.x; drag.ty = p->attr.y;
+	drag.tw = p->attr.width; drag.th = p->attr.height;
+	drag.hinted = profile_need(p, PF_FLAGS)->flags & WINDOW_HINTS
+		&& XGetWMNormalHints(display, p->win, &drag.hints, &userhints);
+	drag.pending = 0; drag.last = 0;
+	if (drag.preview)
+	{
+		XSetWindowAttributes attr; attr.override_redirect = True;
+		for (i = 0; i < 4; i++)
+		{
+			drag.outline[i] = XNewWindow(display, root, 0, 0, 1, 1, 0, None, "Blue", APIS_CLASS, APIS_CLASS);
+			XChangeWindowAttributes(display, drag.outline[i], CWOverrideRedirect, &attr);
+		}
+		drag_outline();
+		for (i = 0; i < 4; i++) XMapWindow(display, drag.outline[i]);
+	}
+}
+// the target grid box for tiled windows, else the target rectangle
+void drag_outline()
+{
+	int x = drag.tx, y = drag.ty, w = drag.tw, h = drag.th, width = 2;
+	profile *p = profile_get(drag.win);
+	// the same choice window_configure() makes on the drop
+	box *b = p ? window_snap_box(p, x, y, w, h): NULL;
+	if (b) { x = b->x + pad_left; y = b->y + pad_top; w = b->w; h = b->h; }
+	XMoveResizeWindow(display, drag.outline[0], x, y, width, h);
+	XMoveResizeWindow(display, drag.outline[1], x + w - width, y, width, h);
+	XMoveResizeWindow(display, drag.outline[2], x, y, w, width);
+	XMoveResizeWindow(display, drag.outline[3], x, y + h - width, w, width);
+}
+void drag_motion(int x_root, int y_root)
+{
+	int xd = x_root - drag.x, yd = y_root - drag.y;
+	drag.tx = drag.attr.x + (drag.button == 1 ? xd : 0);
+	drag.ty = drag.attr.y + (drag.button == 1 ? yd : 0);
+	drag.tw = MAX(1, drag.attr.width  + (drag.button == 3 ? xd : 0));
+	drag.th = MAX(1, drag.attr.height + (drag.button == 3 ? yd : 0));
+	if (drag.hinted) XApplySizeHints(&drag.hints, &drag.tw, &drag.th);
+	drag.pending = 1;
+	drag_flush();
+}
+// send the latest target if a tick has passed since the last one
+void drag_flush()
+{
+	if (!drag.pending) return;
+	ulcell now = clock_ms();
+	if (now < drag.last + DRAG_TICK) return;
+	if (drag.preview)
+		drag_outline();
+	else
+		XMoveResizeWindow(display, drag.win, drag.tx, drag.ty, drag.tw, drag.th);
+	drag.pending = 0; drag.last = now;
+}
+int drag_due(int ms)
+{
+	if (!drag.pending) return ms;
+	ulcell now = clock_ms();
+	return MIN(ms, drag.last + DRAG_TICK > now ? (int)(drag.last + DRAG_TICK - now): 0);
+}
+// the window is already active from the press, so the drop only places it
+void drag_stop()
+{
+	int i;
+	Window w = drag.win;
+	if (w == None) return;
+	drag.win = None; drag.pending = 0;
+	if (drag.preview)
+		for (i = 0; i < 4; i++) XDestroyWindow(display, drag.outline[i]);
+	profile *p = profile_get(w);
+	if (p)
+	{
+		p->attr.x = drag.tx; p->attr.y = drag.ty;
+		p->attr.width = drag.tw; p->attr.height = drag.th;
+		// the box the window snapped into becomes active on its grid
+		box *b = window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
+		if (b)
+		{
+			grid *g = grids[p->desktop < 0 ? current: p->desktop];
+			g->active = b - g->boxes;
+			grid_configure(g);
+		}
+	}
+}
 void event_ButtonPress(XEvent *e)
 {
 	while(XCheckTypedEvent(display, ButtonPress, e));
@@ -1640,12 +2595,10 @@ void event_ButtonPress(XEvent *e)
 		ewmh_windows();
 		if (be->state & Mod4Mask)
 		{
-			drag_win = be->subwindow;
-			drag_x = be->x_root; drag_y = be->y_root; drag_button = be->button;
-			XGetWindowAttributes(display, p->win, &drag_attr);
+			drag_start(p, be);
 			XGrabPointer(display, be->subwindow, True, PointerMotionMask|ButtonReleaseMask,
 				GrabModeAsync, GrabModeAsync, None, None, CurrentTime);
-			if (drag_button == 3) window_clr_flags(p, WINDOW_TILED);
+			if (drag.button == 3) window_clr_flags(p, WINDOW_TILED);
 		}
 	} else
 	{
@@ -1658,34 +2611,19 @@ void event_ButtonPress(XEvent *e)
 }
 void event_ButtonRelease(XEvent *e)
 {
+	int x = e->xbutton.x_root, y = e->xbutton.y_root;
 	XUngrabPointer(display, CurrentTime);
-	profile *p;
-	if (drag_win != None && (p = profile_update(drag_win, 0)) != NULL)
-	{
-		drag_win = None;
-		window_activate(p, 1);
-		window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
-	}
 	while(XCheckTypedEvent(display, MotionNotify, e));
+	// throttled motion may lag the pointer, so the drop targets the release point
+	if (drag.win != None) drag_motion(x, y);
+	drag_stop();
 }
 void event_MotionNotify(XEvent *e)
 {
-	int xd, yd;
 	while(XCheckTypedEvent(display, MotionNotify, e));
 	XMotionEvent *motion = &e->xmotion;
-	XButtonEvent *button = &e->xbutton;
-	if (motion->same_screen)
-	{
-		profile *p = profile_update(motion->window, 0);
-		xd = button->x_root - drag_x;
-		yd = button->y_root - drag_y;
-		int x = drag_attr.x + (drag_button == 1 ? xd : 0);
-		int y = drag_attr.y + (drag_button == 1 ? yd : 0);
-		int w = MAX(1, drag_attr.width + (drag_button == 3 ? xd : 0));
-		int h = MAX(1, drag_attr.height + (drag_button == 3 ? yd : 0));
-		XFriendlyResize(display, motion->window, x, y, w, h,
-			p->flags & WINDOW_HINTS ?1:0, 0);
-	}
+	if (drag.win != None && motion->same_screen)
+		drag_motion(motion->x_root, motion->y_root);
 }
 void event_EnterNotify(XEvent *e)
 {
@@ -1720,10 +2658,12 @@ void event_VisibilityNotify(XEvent *e)
 {
 	XCompressEvents(display, e);
 }
+// substructure events on root carry root in xany.window, so compressing them
+// would swallow other windows' events and desync the stacking mirror
 void event_CreateNotify(XEvent *e)
 {
-	XCompressEvents(display, e);
 	XCreateWindowEvent *cw = &e->xcreatewindow;
+	if (cw->parent == root) stacking_raise(cw->window);
 	profile *p = profile_update(cw->window, 1);
 	if (!p) return;
 	if (window_manage(p))
@@ -1731,7 +2671,7 @@ void event_CreateNotify(XEvent *e)
 		window_track(p);
 		window_set_state(p, WithdrawnState);
 	} else
-	if (strcmp(p->class, APIS_CLASS) == 0)
+	if (strcmp(profile_need(p, PF_CLASS)->class, APIS_CLASS) == 0)
 	{
 		XSelectInput(display, p->win, PropertyChangeMask);
 		XAtomSetString(display, ApisReady, p->win, "ok");
@@ -1739,37 +2679,51 @@ void event_CreateNotify(XEvent *e)
 }
 void event_DestroyNotify(XEvent *e)
 {
-	XCompressEvents(display, e);
-	winlist_discard(&windows, e->xany.window);
-	profile_purge(e->xany.window);
+	Window w = e->xdestroywindow.window;
+	winlist_discard(&stacking, w);
+	winlist_discard(&windows, w);
+	profile_purge(w);
 }
+// map and unmap work from the cached profile: struts are only recomputed when
+// a strut owner changes, and the client lists only when a managed window does
 void event_UnmapNotify(XEvent *e)
 {
-	XCompressEvents(display, e);
 	XUnmapEvent *ue = &e->xunmap;
-	profile *p = profile_update(ue->window, 0);
-	if (p && p->state == NormalState)
+	profile *p = profile_get(ue->window);
+	if (!p) return;
+	p->attr.map_state = IsUnmapped;
+	focusrects_dirty = 1;
+	if (profile_need(p, PF_STATE)->state == NormalState)
 		window_set_state(p, WithdrawnState);
-	ubyte *udata = NULL; ucell len;
-	if (XAtomGet(display, NetActiveWindow, root, &udata, &len) && udata && len
-		&& *((Window*)udata) == ue->window)
+	if (ue->window == netactive)
 		window_activate_last();
-	free(udata);
-	update_struts();
-	ewmh_windows();
+	if (winlist_find(&struts, ue->window) >= 0)
+		update_struts();
+	if (window_manage(p))
+	{
+		ewmh_windows();
+		hook_run(HOOK_UNMAP, "0x%lx", ue->window);
+	}
 }
 void event_MapNotify(XEvent *e)
 {
-	XCompressEvents(display, e);
-	profile *p = profile_update(e->xmap.window, 0);
-	if (!p) return;
+	Window w = e->xmap.window;
+	profile *p = profile_get(w);
+	if (p) { p->attr.map_state = IsViewable; focusrects_dirty = 1; }
+	else if (!(p = profile_update(w, 0))) return;
 	window_set_state(p, NormalState);
-	if (window_manage(p))
+	bool managed = window_manage(p);
+	if (managed)
 		window_update_desktop(p, current);
 	else window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
-	if (window_struts(e->xmap.window, NULL, NULL, NULL, NULL))
+	profile_need(p, PF_STRUTS);
+	if (winlist_find(&struts, w) >= 0)
 		update_struts();
-	ewmh_windows();
+	if (managed)
+	{
+		ewmh_windows();
+		hook_run(HOOK_MAP, "0x%lx", w);
+	}
 }
 void event_MapRequest(XEvent *e)
 {
@@ -1787,24 +2741,37 @@ void event_MapRequest(XEvent *e)
 }
 void event_ReparentNotify(XEvent *e)
 {
+	XReparentEvent *re = &e->xreparent;
+	if (re->parent == root)
+		stacking_raise(re->window);
+	else	winlist_discard(&stacking, re->window);
 }
 void event_ConfigureNotify(XEvent *e)
 {
-	int i;
-	XCompressEvents(display, e);
 	XConfigureEvent *ce = &e->xconfigure;
+	if (ce->event == root && ce->window != root)
+	{
+		stacking_place(ce->window, ce->above);
+		// keep cached geometry current so map and unmap need not refetch it
+		profile *p = profile_get(ce->window);
+		if (p)
+		{
+			p->attr.x = ce->x; p->attr.y = ce->y;
+			p->attr.width = ce->width; p->attr.height = ce->height;
+			p->attr.border_width = ce->border_width;
+			p->attr.override_redirect = ce->override_redirect;
+			focusrects_dirty = 1;
+		}
+		return;
+	}
 	if (ce->window == root && (screen->width != ce->width || screen->height != ce->height))
 	{
 		screen->width = ce->width;
 		screen->height = ce->height;
 		screen_width  = screen->width  - pad_left - pad_right ;
 		screen_height = screen->height - pad_top  - pad_bottom;
-		for (i = 0; i < MAX_DESKTOPS; i++)
-		{
-			grid_free(grids[i]);
-			grids[i] = grid_create(screen_width, screen_height);
-			grid_snapshot(grids[i], i);
-		}
+		if (grid_fit(current))
+			desktop_configure(current);
 	}
 }
 void event_ConfigureRequest(XEvent *e)
@@ -1827,6 +2794,11 @@ void event_ResizeRequest(XEvent *e)
 }
 void event_CirculateNotify(XEvent *e)
 {
+	XCirculateEvent *ce = &e->xcirculate;
+	if (ce->event != root) return;
+	if (ce->place == PlaceOnTop)
+		stacking_raise(ce->window);
+	else	stacking_place(ce->window, None);
 }
 void event_CirculateRequest(XEvent *e)
 {
@@ -1836,17 +2808,45 @@ void event_PropertyNotify(XEvent *e)
 	XPropertyEvent *pe = &e->xproperty;
 //	char *name = XGetAtomName(display, pe->atom);
 //	 if (name) XFree(name);
+	if (pe->atom == XA_WM_TRANSIENT_FOR)
+	{
+		profile *p = profile_get(pe->window);
+		if (p) profile_transient(p);
+	} else
 	if (pe->atom == atoms[ApisCommandCode])
 	{
-		ubyte *cmd = NULL; char *in = NULL; ucell len = 0; ubyte cc = OP_NOP;
+		ubyte *cmd = NULL; char *in = NULL; ucell len = 0, cc = OP_NOP;
 		autostr out; str_create(&out); ucell rc = 0;
 		if (XAtomGet(display, ApisCommandCode, pe->window, &cmd, &len) && cmd && len)
 			cc = *((ucell*)cmd);
-		XAtomGetString(display, ApisCommandIn, pe->window, &in, &len);
-		if (opcode[cc]) rc = opcode[cc](in, &out);
+		if (XAtomGetString(display, ApisCommandIn, pe->window, &in, &len) && in && cc < OP_LAST && opcode[cc])
+		{
+			hash *args = hash_decode(in);
+			rc = opcode[cc](args, &out);
+			hash_free(args, 1);
+		}
 		XAtomSetString(display, ApisResultOut, pe->window, out.pad);
 		XAtomSet(display, ApisResultCode, pe->window, XA_INTEGER, 32, &rc, 1);
 		free(cmd); free(in); str_free(&out);
+	} else
+	if (pe->atom == atoms[ApisBatchIn] && pe->state == PropertyNewValue)
+	{
+		batch_run(pe->window);
+	} else
+	{
+		profile *p = profile_get(pe->window);
+		ucell bits = property_fields(pe->atom);
+		// our own writes already updated the cache
+		if (p && bits && profile_echoed(p, bits)) return;
+		if (p) profile_forget(p, bits);
+		// desktop and overhead membership must follow before the next switch or raise
+		if (p && bits & (PF_DESKTOP|PF_EWMHSTATE|PF_TYPE))
+			profile_need(p, bits & (PF_DESKTOP|PF_EWMHSTATE|PF_TYPE));
+		if (p && bits & PF_STRUTS && p->attr.map_state == IsViewable)
+		{
+			profile_need(p, PF_STRUTS);
+			update_struts();
+		}
 	}
 /*	else
 	if (pe->atom == atoms[NetWMState])
@@ -1901,7 +2901,7 @@ void event_ClientMessage(XEvent *e)
 		{
 			desktop_raise(target);
 			ewmh_desktops();
-			hook_run(HOOK_SWITCH_DESKTOP);
+			hook_run(HOOK_SWITCH_DESKTOP, "%d", target);
 		}
 	} else
 	if (cm->message_type == atoms[NetMoveResizeWindow])
@@ -1912,12 +2912,12 @@ void event_ClientMessage(XEvent *e)
 	if (cm->message_type == atoms[NetNumberOfDesktops])
 	{
 		desktops = MIN(MAX_DESKTOPS, MAX(1, cm->data.l[0]));
-		XIterateChildren(display, root, desktop_rescue, NULL);
+		stacking_iterate(desktop_rescue, NULL);
 		ewmh_desktops();
 	} else
 	if (cm->message_type == atoms[NetWMState])
 	{
-		int i, j; ucell state = p->ewmh_state; //, ostate = state;
+		int i, j; ucell state = profile_need(p, PF_EWMHSTATE)->ewmh_state; //, ostate = state;
 		for (i = 0; i < 2; i++)
 		{
 			if (!cm->data.l[i+1]) continue;
@@ -1933,6 +2933,9 @@ void event_ClientMessage(XEvent *e)
 			}
 		}
 		XSetEWMHState(display, cm->window, state); p->ewmh_state = state;
+		profile_wrote(p, PF_EWMHSTATE);
+		desktop_index(p);
+		overhead_index(p);
 		window_configure(p, 0, 0, 0, 0, 0, 0, NULL, NULL);
 /*		ucell hstate = (1 << (NetWMStateHidden - NetWMState));
 		if ((ostate & hstate) != (state & hstate))
@@ -1948,7 +2951,10 @@ void event_ClientMessage(XEvent *e)
 		int desktop = cm->data.l[0];
 		window_set_desktop(p, desktop);
 		if (desktop != DESKTOP_ALL && desktop != current)
+		{
 			XLowerWindow(display, p->win);
+			stacking_place(p->win, None);
+		}
 		ewmh_windows();
 	}
 }
@@ -1966,65 +2972,203 @@ void event_GenericEvent(XEvent *e)
 {
 }
 #endif
+// run every op in a window's APIS_BATCH_IN and answer in APIS_BATCH_OUT
+void batch_run(Window win)
+{
+	ubyte *data = NULL; ucell len = 0, off = 0;
+	autostr res; str_create(&res);
+	if (XAtomGet(display, ApisBatchIn, win, &data, &len) && data)
+	{
+		while (len - off >= sizeof(ucell) * 2)
+		{
+			ucell code, size, rc = 0;
+			memmove(&code, data + off, sizeof(ucell));
+			memmove(&size, data + off + sizeof(ucell), sizeof(ucell));
+			off += sizeof(ucell) * 2;
+			if (size > len - off) break;
+			hash *args = hash_unpack(data + off, size);
+			off += size;
+			autostr out; str_create(&out);
+			if (args && code < OP_LAST && opcode[code])
+				rc = opcode[code](args, &out);
+			if (args) hash_free(args, 1);
+			str_append(&res, (char*)&rc, sizeof(ucell));
+			str_append(&res, (char*)&out.len, sizeof(ucell));
+			str_append(&res, out.pad, out.len);
+			str_free(&out);
+		}
+	}
+	free(data);
+	XAtomSet(display, ApisBatchOut, win, XA_CARDINAL, 8, res.pad, res.len);
+	str_free(&res);
+}
 void timeout(int sig)
 {
 	fprintf(stderr, "timed out");
 	exit(EXIT_FAILURE);
 }
-bool insert_command(ucell code, char* cmd)
+// block until the main wm process sets atom on our window
+void command_wait(Window win, ucell atom, int secs)
 {
-	Window win = XNewWindow(display, root, -1, -1, 1, 1, 0, None, None, APIS_CLASS, APIS_CLASS);
-	XSelectInput (display, win, PropertyChangeMask);
-	// wait for main wm process to set ApisReady on our window
-	signal(SIGALRM, timeout); alarm(5);
+	signal(SIGALRM, timeout); alarm(secs);
 	for (;;)
 	{
 		XEvent ev;
-		XMaskEvent (display, PropertyChangeMask, &ev);
-		if (ev.xproperty.atom == atoms[ApisReady]
+		XWindowEvent(display, win, PropertyChangeMask, &ev);
+		if (ev.xproperty.atom == atoms[atom]
 	          && ev.xproperty.state == PropertyNewValue)
 			break;
-		usleep(10000);
 	}
+	alarm(0);
+}
+Window command_window()
+{
+	Window win = XNewWindow(display, root, -1, -1, 1, 1, 0, None, None, APIS_CLASS, APIS_CLASS);
+	XSelectInput (display, win, PropertyChangeMask);
+	command_wait(win, ApisReady, 5);
+	return win;
+}
+bool insert_command(ucell code, char* cmd)
+{
+	Window win = command_window();
 	// send command
 	XAtomSetString(display, ApisCommandIn, win, cmd);
 	XAtomSet(display, ApisCommandCode, win, XA_INTEGER, 32, &code, 1);
-	// wait for main wm process to set ApisResult on our window
-	ubyte *data = NULL; char *res; ucell len = 0;
-	signal(SIGALRM, timeout); alarm(5);
-	ucell rc = 0;
+	command_wait(win, ApisResultCode, 5);
+	ubyte *data = NULL; char *res = NULL; ucell len = 0, rc = 0;
+	if (XAtomGet(display, ApisResultCode, win, &data, &len) && data && len)
+	{
+		rc = *((ucell*)data);
+		if (XAtomGetString(display, ApisResultOut, win, &res, &len) && res && len)
+			fprintf(rc ? stdout: stderr, "%s", res);
+	}
+	free(data); free(res);
+	XDestroyWindow(display, win);
+	return rc;
+}
+// send one batch of count ops, reporting failures against their script lines
+bool batch_send(Window win, autostr *ops, ucell count, ucell *lines)
+{
+	bool ok = 1; ucell i = 0, len = 0, off = 0;
+	XAtomSet(display, ApisBatchIn, win, XA_CARDINAL, 8, ops->pad, ops->len);
+	command_wait(win, ApisBatchOut, 5 + count);
+	ubyte *data = NULL;
+	XAtomGet(display, ApisBatchOut, win, &data, &len);
+	for (i = 0; i < count; i++)
+	{
+		ucell rc = 0, size = 0;
+		if (data && len - off >= sizeof(ucell) * 2)
+		{
+			memmove(&rc, data + off, sizeof(ucell));
+			memmove(&size, data + off + sizeof(ucell), sizeof(ucell));
+			off += sizeof(ucell) * 2;
+			size = MIN(size, len - off);
+			fwrite(data + off, 1, size, rc ? stdout: stderr);
+			off += size;
+		}
+		if (!rc)
+		{
+			fprintf(stderr, "line %u: failed\n", lines[i]);
+			ok = 0;
+		}
+	}
+	free(data);
+	ops->len = 0;
+	return ok;
+}
+// split a script line into words in place. double quotes group, backslash escapes
+int script_words(char *line, char **words, int max)
+{
+	int n = 0; char *r = line, *w = line;
 	for (;;)
 	{
-		XEvent ev;
-		XMaskEvent (display, PropertyChangeMask, &ev);
-		if (ev.xproperty.atom == atoms[ApisResultCode]
-	          && ev.xproperty.state == PropertyNewValue)
+		while (isspace(*r)) r++;
+		if (!*r || *r == '#' || n == max) break;
+		words[n++] = w;
+		bool quoted = 0;
+		while (*r && (quoted || !isspace(*r)))
 		{
-			if (XAtomGet(display, ApisResultCode, win, &data, &len) && data && len)
-			{
-				rc = *((ucell*)data);
-				if (XAtomGetString(display, ApisResultOut, win, &res, &len) && res && len)
-					fprintf(rc ? stdout: stderr, "%s", res);
-				free(res);
-				break;
-			}
-			free(data);
+			if (*r == '"') { quoted = !quoted; r++; continue; }
+			if (*r == '\\' && r[1]) r++;
+			*w++ = *r++;
 		}
-		usleep(10000);
+		if (*r) r++;
+		*w++ = '\0';
 	}
-	XDestroyWindow(display, win);
-	return rc;
+	return n;
+}
+// run a file of commands, one per line as for -c, over a single command window
+bool insert_script(char *path)
+{
+	FILE *f = path ? fopen(path, "r"): stdin;
+	if (!f)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 0;
+	}
+	autostr ops; str_create(&ops);
+	ucell count = 0, line = 0, *lines = allocate(sizeof(ucell) * BLOCK);
+	bool ok = 1, sent = 1; char buf[BLOCK*4], *text; Window win = None;
+	char *words[SCRIPT_WORDS]; int i, n;
+	stack *src = stack_create();
+	while (fgets(buf, sizeof(buf), f)) stack_push(src, strdup(buf));
+	if (f != stdin) fclose(f);
+	// check every line first, so a bad script runs nothing rather than half
+	FOR_STACK (text, src, char*, i)
+	{
+		strcpy(buf, text);
+		if ((n = script_words(buf, words, SCRIPT_WORDS)) && !command_find(words[0]))
+		{
+			fprintf(stderr, "line %d: unknown command %s\n", i+1, words[0]);
+			ok = 0;
+		}
+	}
+	FOR_STACK (text, src, char*, i)
+	{
+		if (!ok) break;
+		line = i+1; strcpy(buf, text);
+		if (!(n = script_words(buf, words, SCRIPT_WORDS))) continue;
+		command *com = command_find(words[0]);
+		hash *args = args_to_hash(n, words);
+		autostr packed; str_create(&packed);
+		hash_pack(args, &packed);
+		hash_free(args, 0);
+		if (count && (count == BLOCK || ops.len + packed.len + sizeof(ucell) * 2 > BATCH_BYTES))
+		{
+			if (win == None) win = command_window();
+			sent = batch_send(win, &ops, count, lines) && sent;
+			count = 0;
+		}
+		ucell code = com->code;
+		str_append(&ops, (char*)&code, sizeof(ucell));
+		str_append(&ops, (char*)&packed.len, sizeof(ucell));
+		str_append(&ops, packed.pad, packed.len);
+		lines[count++] = line;
+		str_free(&packed);
+	}
+	if (count)
+	{
+		if (win == None) win = command_window();
+		sent = batch_send(win, &ops, count, lines) && sent;
+	}
+	if (win != None) XDestroyWindow(display, win);
+	FOR_STACK (text, src, char*, i) free(text);
+	stack_free(src);
+	str_free(&ops); free(lines);
+	return ok && sent;
 }
 ubyte setup_window(Window win, void *ptr)
 {
 	profile *p = profile_update(win, 1);
 	if (p)
 	{
+		profile_need(p, PF_STRUTS);
 		if (p->attr.map_state == IsViewable)
 			window_set_state(p, NormalState);
 		if (window_manage(p))
 		{
 			window_track(p);
+			profile_need(p, PF_DESKTOP|PF_STATE|PF_FLAGS);
 			if (p->desktop == DESKTOP_NONE)
 				window_set_desktop(p, current);
 			switch (p->state)
@@ -2052,6 +3196,11 @@ int main(int argc, char *argv[])
 	ubyte *udata; char *data, tmp[NOTE]; ucell len; int i, j;
 	check = time(0);
 
+#if GRID_CHECK_DIFF
+	// runs without a display
+	if (argc == 3 && strcmp(argv[1], "-gridfuzz") == 0)
+		exit(grid_fuzz(strtol(argv[2], NULL, 10)) ? EXIT_SUCCESS: EXIT_FAILURE);
+#endif
 	display = XOpenDisplay(0);
 	assert(display, "cannot open display");
 	xerrorxlib = XSetErrorHandler(XWtf);
@@ -2063,18 +3212,15 @@ int main(int argc, char *argv[])
 	for (i = 0; i < AtomLast; i++)
 		atoms[i] = XInternAtom(display, atom_names[i], False);
 
-	flagnames = hash_create();
-	struct name_to_flag *nf;
-	FOR_ARRAY (nf, names_to_flags, struct name_to_flag, i)
-		hash_set(flagnames, nf->name, nf);
-
-	commandnames = hash_create();
 	command *com;
-	FOR_ARRAY (com, commands, command, i)
-		hash_set(commandnames, com->name, com);
-
 	winlist_init(&windows);
-	profiles = hash_create();
+	winlist_init(&stacking);
+	winlist_init(&struts);
+	for (i = 0; i <= MEMBERS_SHARED; i++) winlist_init(&members[i]);
+	winlist_init(&ewmh_stacked);
+	winlist_init(&ewmh_clients);
+	profiles = table_create();
+	transients = table_create();
 	hook_commands = hash_create();
 
 	char *arg;
@@ -2086,7 +3232,7 @@ int main(int argc, char *argv[])
 	}
 	if ((arg = hash_get_one(arguments, "c,command")) != NULL)
 	{
-		com = hash_get(commandnames, arg);
+		com = command_find(arg);
 		if (com)
 		{
 			char *args = hash_encode(arguments);
@@ -2094,8 +3240,15 @@ int main(int argc, char *argv[])
 		}
 		exit(EXIT_FAILURE);
 	}
+	if (hash_find(arguments, "script"))
+		exit(insert_script(hash_get(arguments, "script")) ? EXIT_SUCCESS: EXIT_FAILURE);
 	debug = hash_find(arguments, "debug") ? 1:0;
+	drag.preview = hash_find(arguments, "preview") ? 1:0;
+	// a hook sink that goes away must not take the wm with it
+	signal(SIGPIPE, SIG_IGN);
 	rules = stack_create();
+	rules_exact = hash_create();
+	rules_scan = stack_create();
 
 	session = (XAtomGetString(display, ApisSession, root, &data, &len) && data && len && !hash_find(arguments, "refresh"))
 		? hash_decode(data): hash_create();
@@ -2116,12 +3269,15 @@ int main(int argc, char *argv[])
 	}
 	if (XAtomGet(display, NetNumberOfDesktops, root, &udata, &len) && udata && len)
 		desktops = MIN(MAX_DESKTOPS, MAX(1, *((int*)udata)));
-	XIterateChildren(display, root, setup_window, NULL);
+	stacking_sync();
+	stacking_iterate(setup_window, NULL);
 	desktop_raise(current);
 	update_struts();
 
 	XDefineCursor(display, root, XCreateFontCursor(display, XC_left_ptr));
 	XSelectInput(display, root, SubstructureRedirectMask | SubstructureNotifyMask | StructureNotifyMask | FocusChangeMask);
+	// from here on events keep the mirror current
+	stacking_sync();
 	XAtomSet(display, NetSupported, root, XA_ATOM, 32, atoms, AtomLast);
 
 	Window e = XNewWindow(display, root, -1, -1, 1, 1, 0, None, None, APIS_CLASS, APIS_CLASS);
@@ -2146,15 +3302,33 @@ int main(int argc, char *argv[])
 	XFreeModifiermap(modmap);
 
 	ewmh(); grabs();
+	winlist_init(&swept);
+	sweeps.next = time(0) + SWEEP_PAUSE;
+	int fd = ConnectionNumber(display);
 	XEvent a;
 	for (;;)
 	{
-		if (check < time(0) - 10)
+		hook_flush();
+		drag_flush();
+		// sweep only when no event arrives within the tick
+		if (!XPending(display))
 		{
-			sanity();
-			check = time(0);
+			session_flush();
+			ewmh_flush();
+			int ms = drag_due(hook_due(sweep_due()));
+			struct timeval tv = { ms / 1000, (ms % 1000) * 1000 };
+			fd_set fds; FD_ZERO(&fds); FD_SET(fd, &fds);
+			if (select(fd+1, &fds, NULL, NULL, &tv) == 0)
+			{
+				if (sweeps.cursor || sweeps.next <= time(0)) sweep();
+				if (debug && check < time(0) - 10)
+				{
+					stacking_check();
+					check = time(0);
+				}
+				continue;
+			}
 		}
-		// event compression
 		XNextEvent(display, &a);
 		event[a.type](&a);
 	}
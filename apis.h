@@ -23,6 +23,9 @@
 #define VERSION "0.1.1"
 #define APIS_CLASS "apis"
 
+#include <sys/select.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "tools.c"
 #include "xwin.c"
 
@@ -40,22 +43,99 @@ typedef struct {
 
 #define BOXES 32
 
+// undo log entry: a box as it was before its first change
+typedef struct {
+	int index;
+	box old;
+} boxlog;
+
 typedef struct _grid {
 	int w, h, count, active;
-	box boxes[BOXES];
+	box *boxes;
+	ucell limit;
 	ucell flags;
+	// undo log for the change in progress, see grid_begin()
+	boxlog *log;
+	ucell logged, loglimit;
+	int was_w, was_h, was_count, was_active;
 } grid;
 
+#define FOR_BOXES(p,g,i) for ((i) = 0; (i) < (g)->count && (((p) = &(g)->boxes[i]) || 1); (i)++)
+
 #define GRID_VISIBLE 1
+// grid flags kept across restarts
+#define GRID_PERSIST GRID_VISIBLE
+// grid_dump() format version, and a sanity bound for loading
+#define GRID_FORMAT 2
+#define BOXES_MAX 4096
+
+// layouts of raw snapshots written before GRID_FORMAT existed
+#define LEGACY_BOXES 32
+typedef struct {
+	int x, y, w, h;
+	void *ptr;
+	Window l, r, t, b;
+} legacy_box;
+typedef struct {
+	int w, h, count, active;
+	legacy_box boxes[LEGACY_BOXES];
+	ucell flags;
+} legacy_grid;
+
+// grid_check_boxes() sweep events and active y spans
+typedef struct { int at, s, e; ubyte in; } boxevent;
+typedef struct { int s, e; } span;
+// grid_check_empty() box sides on one line, and the running integral of
+// how many sides cover a point
+typedef struct { int at, s, e, box; ubyte far; } boxedge;
+typedef struct { int at, delta, depth; dcell area; } coverage;
+
+// cross-check grid_check() against the pairwise reference, and enable -gridfuzz N
+#ifndef GRID_CHECK_DIFF
+#define GRID_CHECK_DIFF 0
+#endif
 
 ucell NumlockMask;
-Window drag_win = None; int drag_x, drag_y, drag_button;
-XWindowAttributes drag_attr;
+// pointer drag: size hints are read once at the start, and motion only records
+// the target, which drag_flush() sends at most once per DRAG_TICK ms. with
+// -preview an outline follows the pointer and the client is configured on drop
+#define DRAG_TICK 16
+typedef struct {
+	Window win;
+	int x, y, button;
+	XWindowAttributes attr;
+	XSizeHints hints;
+	bool hinted, pending, preview;
+	int tx, ty, tw, th;
+	ulcell last;
+	Window outline[4];
+} dragger;
+dragger drag;
 Window canvas;
 #define MAX_DESKTOPS 10
 ucell desktops;
 ucell current;
 winlist windows;
+winlist stacking;
+// windows carrying _NET_WM_STRUT(_PARTIAL), so strut updates need not walk the tree
+winlist struts;
+// _NET_CLIENT_LIST(_STACKING) as last written, rebuilt by ewmh_flush() when dirty
+winlist ewmh_stacked, ewmh_clients;
+bool ewmh_dirty = 0;
+// windows by desktop; sticky and all-desktop windows share the extra list
+#define MEMBERS_SHARED MAX_DESKTOPS
+winlist members[MAX_DESKTOPS+1];
+// windows that stack above the rest: override redirect, _NET_WM_STATE_ABOVE and
+// docks not kept below. maintained by overhead_index() from cached fields
+winlist overhead;
+// a window and its place in the stacking mirror, for ordering part of it
+typedef struct { int index; Window win; } stackpos;
+// focusable window rectangles on the current desktop for directional focus,
+// rebuilt from cached profiles after geometry or visibility changes
+typedef struct { Window win; int x, y, w, h; } focusrect;
+focusrect *focusrects;
+ucell focusrects_count = 0, focusrects_limit = 0;
+bool focusrects_dirty = 1;
 
 ucell pad_left = 0, pad_right = 0, pad_top = 0, pad_bottom = 0,
 	screen_x = 0, screen_y = 0, screen_width = 0, screen_height = 0;
@@ -110,8 +190,6 @@ struct name_to_flag names_to_flags[] = {
 	{ "demands_attention", WINDOW_ATTENTION },
 };
 
-hash *flagnames;
-
 typedef struct _control {
 	char *key;
 	ucell mod;
@@ -127,6 +205,8 @@ enum { OP_NOP,
 OP_SPLIT, OP_REMOVE, OP_OVERLAY, OP_RULE, OP_SHOW, OP_FOCUS, OP_SIZE, OP_RESET, OP_CONFIG, OP_FLAGS, OP_HOOK,
 OP_LAST };
 
+// class, name, role, type, tag
+#define RULE_FIELDS 5
 typedef struct {
 	ucell rflags;
 	char class[NOTE];
@@ -138,8 +218,17 @@ typedef struct {
 	ucell setflags, clrflags, flipflags;
 	int x, y, w, h, f;
 	int cols, rows;
+	// compiled by rule_create()
+	regex_t re[RULE_FIELDS];
+	ucell compiled, seq;
+	ubyte litmode;
+	char lit[NOTE];
+	ucell litlen;
 } rule;
 
+// literal class text every match must contain
+enum { LIT_NONE, LIT_EXACT, LIT_PREFIX, LIT_SUBSTR };
+
 #define RULE_CLASS 1
 #define RULE_NAME (1<<1)
 #define RULE_ROLE (1<<2)
@@ -174,17 +263,55 @@ struct rule_iter {
 	winlist siblings;
 };
 
-enum { HOOK_SWITCH_DESKTOP,
+enum { HOOK_SWITCH_DESKTOP, HOOK_FOCUS, HOOK_MAP, HOOK_UNMAP, HOOK_GRID, HOOK_RULE,
 HOOK_LAST};
 
 char *hook_names[HOOK_LAST] = {
 	[HOOK_SWITCH_DESKTOP] = "switch_desktop",
+	[HOOK_FOCUS] = "focus",
+	[HOOK_MAP] = "map",
+	[HOOK_UNMAP] = "unmap",
+	[HOOK_GRID] = "grid",
+	[HOOK_RULE] = "rule",
 };
 hash *hook_commands;
 
+// hooks fire at most once per debounce ms; a firing inside the interval is held
+// and sent, with its latest detail, when the interval ends
+typedef struct {
+	ucell debounce;
+	ulcell last;
+	bool pending;
+	char detail[NOTE];
+} hookstate;
+hookstate hooks[HOOK_LAST];
+ucell hooks_pending = 0;
+// the sink is one coprocess or fifo reading "event<tab>detail" lines
+int hook_fd = -1;
+pid_t hook_pid = 0;
+char hook_fifo[NOTE];
+
+// profile fields fetched on demand by profile_need()
+#define PF_FLAGS 1
+#define PF_CLASS (1<<1)
+#define PF_NAME (1<<2)
+#define PF_ROLE (1<<3)
+#define PF_TAG (1<<4)
+#define PF_TYPE (1<<5)
+#define PF_TYPENAME (1<<6)
+#define PF_EWMHSTATE (1<<7)
+#define PF_STATE (1<<8)
+#define PF_DESKTOP (1<<9)
+#define PF_STRUTS (1<<10)
+#define PF_HINTS (1<<11)
+#define PF_BITS 12
+#define PF_IDENT (PF_CLASS|PF_NAME|PF_ROLE|PF_TYPENAME|PF_TAG)
+// fields window_focusable() depends on
+#define PF_FOCUSABLE (PF_STATE|PF_EWMHSTATE|PF_DESKTOP|PF_TYPE|PF_CLASS)
+
 typedef struct {
-	Window win, trans, parent, *kids;
-	ucell nkids;
+	Window win, trans;
+	ucell valid;
 	char class[NOTE];
 	char name[NOTE];
 	char role[NOTE];
@@ -194,13 +321,23 @@ typedef struct {
 	ucell ewmh_state;
 	int state;
 	int desktop;
+	// members[] list holding this window, or -1
+	int member;
+	// PropertyChangeMask is selected, so our own writes echo back
+	bool watched;
+	// per field count of our own writes whose PropertyNotify has not arrived yet
+	ubyte echo[PF_BITS];
 	ucell flags;
 	ucell left, right, top, bottom;
 	XWindowAttributes attr;
 	XWMHints *hints;
+	// memoized rule_find(), valid while rules_version matches
+	rule *rule;
+	ucell rules_version;
 } profile;
 
-hash *profiles;
+table *profiles;
+table *transients;
 
 #include "apis_proto.h"
 
@@ -243,7 +380,7 @@ void (*event[LASTEvent])(XEvent*) = {
 #endif
 };
 
-bool (*opcode[OP_LAST])(char*, autostr*) = {
+bool (*opcode[OP_LAST])(hash*, autostr*) = {
 	[OP_NOP] = NULL,
 	[OP_SPLIT] = op_split,
 	[OP_REMOVE] = op_remove,
@@ -270,11 +407,40 @@ command commands[] = {
 	{ "hook", OP_HOOK },
 };
 
-hash *commandnames;
+
+// APIS_BATCH_IN holds per op a ucell opcode, a ucell length and that many bytes of
+// hash_pack()ed arguments; APIS_BATCH_OUT answers with per op a ucell result code,
+// a ucell length and the output. scripts are sent in batches of up to BATCH_BYTES
+#define BATCH_BYTES (BLOCK*64)
+#define SCRIPT_WORDS 64
 
 hash *session;
+bool session_dirty = 0;
+// incremental profile validation: SWEEP_BATCH profiles per idle tick of
+// SWEEP_TICK ms, with SWEEP_PAUSE seconds between complete passes
+#define SWEEP_BATCH 8
+#define SWEEP_TICK 250
+#define SWEEP_PAUSE 10
+typedef struct {
+	ucell cursor, passes, ticks, checked, purged;
+	time_t next;
+	// windows profiled when the pass began. table slots move under table_del()
+	// and table_grow(), so the cursor walks this instead
+	winlist cycle;
+} sweeper;
+sweeper sweeps;
+winlist swept;
+
 stack *rules;
+// rules with an exact literal class, by class; all others are scanned
+hash *rules_exact;
+stack *rules_scan;
+ucell rule_seq = 0;
+// bumped whenever the rule set changes
+ucell rules_version = 1;
 Window lastactive = None;
+// mirror of _NET_ACTIVE_WINDOW
+Window netactive = None;
 ucell check;
 
 #define DESKTOP_ALL -1
@@ -1,4 +1,7 @@
 void session_set(char *key, char *val, bool copy);
+void session_flush();
+void ewmh_flush();
+bool ewmh_list_same(winlist *a, winlist *b);
 char* session_get(char *key, char *def);
 void box_init(box *b, int x, int y, int w, int h);
 void box_free(box *b);
@@ -7,30 +10,66 @@ ubyte box_adjacent_within(box *s, int x, int y, int w, int h);
 ubyte nearest_side(int ax, int ay, int aw, int ah, int bx, int by, int bw, int bh);
 bool region_overlap_y(int ax, int ay, int aw, int ah, int bx, int by, int bw, int bh);
 bool region_overlap_x(int ax, int ay, int aw, int ah, int bx, int by, int bw, int bh);
+bool window_focusable(profile *p);
+void focusrects_rebuild();
+Window window_by_region(int x, int y, int w, int h, Window except);
 bool box_intersect(box *s, int x, int y, int width, int height);
 char* grid_dump(grid *g);
+bool grid_load_legacy(grid *g, char *desc);
 void grid_load(grid *g, char *desc);
 void grid_snapshot(grid *g, int id);
 grid* grid_create(int w, int h);
 void grid_free(grid *g);
-grid *grid_copy(grid *g);
+void grid_reserve(grid *g, ucell count);
+void grid_begin(grid *g);
+void grid_touch(grid *g, box *b);
+void grid_rollback(grid *g);
 void grid_make_gap(grid *g, int x, int y, int w, int h, box *except);
 bool grid_fill_gap(grid *g, int x, int y, int w, int h, box *except);
+bool grid_check_boxes_pairwise(grid *g);
+bool grid_check_empty_pairwise(grid *g);
+int boxevent_cmp(const void *a, const void *b);
+int span_after(span *a, int n, int s);
 bool grid_check_boxes(grid *g);
+int boxedge_cmp(const void *a, const void *b);
+int coverage_cmp(const void *a, const void *b);
+ucell coverage_build(coverage *c, boxedge *e, int n);
+dcell coverage_at(coverage *c, int m, int t);
+bool grid_check_side(grid *g, ubyte vertical);
 bool grid_check_empty(grid *g);
 bool grid_check(grid *g);
-bool grid_autocommit(grid *g, grid *cpy);
+bool grid_fuzz(ucell rounds);
+bool grid_autocommit(grid *g);
 bool grid_insert(grid *g, int x, int y, int w, int h);
 bool grid_remove(grid *g, int index);
 bool grid_resize(grid *g, int index, int x, int y, int w, int h);
 bool grid_adjust(grid *g, int w, int h);
+bool grid_rescale(grid *g, int w, int h);
+bool grid_fit(int d);
 void grid_hide(grid *g);
 void grid_show(grid *g);
 void grid_configure(grid *g);
 box* grid_box_by_region(grid *g, int x, int y, int w, int h);
+bool rule_literal(rule *r, char *class);
 ucell rule_match(rule *r, char *class, char *name, char *role, char *type, char *tag);
+rule* rule_best(stack *s, rule *match, ucell *most, char *class, char *name, char *role, char *type, char *tag);
 rule* rule_find(char *class, char *name, char *role, char *type, char *tag);
+void rule_literal_scan(rule *r);
+void rule_compile(rule *r);
+void rule_free(rule *r);
+void rule_add(rule *r);
+void rule_remove(rule *r);
 rule* rule_create(ucell rflags, char *class, char *name, char *role, char *type, char *tag, byte desktop, ucell setflags, ucell clrflags, ucell flipflags, int x, int y, int w, int h, int f, int cols, int rows);
+void transient_link(Window parent, Window kid);
+void transient_unlink(Window parent, Window kid);
+void transient_forget(Window parent);
+void stacking_sync();
+void stacking_place(Window w, Window sibling);
+void stacking_raise(Window w);
+void stacking_restack(Window *wins, ucell num);
+Window stacking_iterate(XIterator cb, void *ptr);
+Window stacking_iterate_back(XIterator cb, void *ptr);
+void stacking_check();
 void window_name(Window win, char *pad);
 void window_class(Window win, char *pad);
 void window_role(Window win, char *pad);
@@ -38,17 +77,33 @@ void window_tag(Window win, char *pad);
 bool window_struts(Window win, ucell *l, ucell *r, ucell *t, ucell *b);
 profile* profile_get(Window w);
 void profile_set(Window w, profile *p);
-void sanity_cb(hash *h, char *key, void *val);
-void hook_run(ucell hook);
-void sanity();
+void hook_close();
+bool hook_sink_ready();
+bool hook_sink_command(char *cmd);
+bool hook_sink_fifo(char *path);
+void hook_emit(ucell hook, ulcell now);
+void hook_run(ucell hook, char *fmt, ...);
+void hook_flush();
+int hook_due(int ms);
+int sweep_error(Display *d, XErrorEvent *ee);
+void sweep();
+int sweep_due();
 int window_get_state(Window w);
 ucell window_get_flags(Window w);
 int window_get_desktop(Window w);
+void profile_transient(profile *p);
 profile* profile_update(Window w, bool refresh);
+ucell property_fields(Atom a);
+ubyte* profile_echo(profile *p, ucell bit);
+void profile_wrote(profile *p, ucell bit);
+bool profile_echoed(profile *p, ucell bit);
+void profile_forget(profile *p, ucell bits);
+profile* profile_need(profile *p, ucell bits);
 void profile_free(profile *p);
 void profile_purge(Window w);
 bool window_manage(profile *p);
 bool window_visible(profile *p);
+void window_set_active(Window w);
 void window_set_state(profile *p, int state);
 void window_set_flags(profile *p, ucell flag);
 void window_clr_flags(profile *p, ucell flag);
@@ -57,10 +112,11 @@ void window_update_desktop(profile *p, int d);
 rule* window_rule(profile *p);
 rule* window_prepare(profile *p, ubyte refresh, rule *r);
 void window_track(profile *p);
-void window_raise_kids(Window w, Window except, Window *wins, ucell num, Window *trans, winlist *local, ubyte *used, ubyte *attrok, ubyte *view, ubyte *manage);
+void window_raise_kids(Window w, Window except, winlist *local);
 void window_raise(profile *p);
 void window_focus(profile *p);
 void window_check_visible(profile *p);
+box* window_snap_box(profile *p, int x, int y, int w, int h);
 box* window_configure(profile *p, ucell mask, int x, int y, int w, int h, int b, rule *r, winlist *sibs);
 box* window_restore(profile *p);
 void window_iconify(profile *p);
@@ -69,7 +125,10 @@ void ewmh_windows();
 void ewmh_desktops();
 void ewmh();
 ubyte desktop_rescue(Window w, void *ptr);
-ubyte desktop_raise_cb(Window w, void *ptr);
+void desktop_index(profile *p);
+bool window_overhead(profile *p);
+void overhead_index(profile *p);
+int stackpos_cmp(const void *a, const void *b);
 void desktop_raise(int d);
 bool desktop_refresh_cb(Window w, void *ptr);
 void desktop_configure(int d);
@@ -77,30 +136,39 @@ bool update_struts_cb(Window w, void *ptr);
 void update_struts();
 void window_activate(profile *p, bool refresh);
 void window_activate_last();
+command* command_find(char *name);
+struct name_to_flag* flag_find(char *name);
 bool parse_flags_type(hash *args, char *name, ucell *f);
 bool parse_flags(hash *args, ucell *sf, ucell *cf, ucell *tf);
 ubyte parse_mode(hash *args);
 char* parse_direction(hash *args);
 bool parse_int(hash *args, char *name, int *r);
-bool op_split(char *in, autostr *out);
-bool op_size(char *in, autostr *out);
-bool op_remove(char *in, autostr *out);
-bool op_overlay(char *in, autostr *out);
+bool op_split(hash *args, autostr *out);
+bool op_size(hash *args, autostr *out);
+bool op_remove(hash *args, autostr *out);
+bool op_overlay(hash *args, autostr *out);
 rule* parse_rule(hash *args);
-bool op_rule(char *in, autostr *out);
-bool op_hook(char *in, autostr *out);
+bool op_rule(hash *args, autostr *out);
+bool op_hook(hash *args, autostr *out);
 bool op_config_cb(Window w, void *ptr);
-bool op_config(char *in, autostr *out);
+bool op_config(hash *args, autostr *out);
 bool op_reset_cb(Window w, void *ptr);
-bool op_reset(char *in, autostr *out);
+bool op_reset(hash *args, autostr *out);
+void op_show_sweep(autostr *out);
 void op_show_rules(autostr *out);
 void op_show_grid(autostr *out);
 void op_show_hooks(autostr *out);
-bool op_show(char *in, autostr *out);
-bool op_focus(char *in, autostr *out);
+bool op_show(hash *args, autostr *out);
+bool op_focus(hash *args, autostr *out);
 void grabs();
 void event_KeyPress(XEvent *e);
 void event_KeyRelease(XEvent *e);
+void drag_start(profile *p, XButtonEvent *be);
+void drag_outline();
+void drag_motion(int x_root, int y_root);
+void drag_flush();
+int drag_due(int ms);
+void drag_stop();
 void event_ButtonPress(XEvent *e);
 void event_ButtonRelease(XEvent *e);
 void event_MotionNotify(XEvent *e);
@@ -134,6 +202,12 @@ void event_ClientMessage(XEvent *e);
 void event_MappingNotify(XEvent *e);
 void event_GenericEvent(XEvent *e);
 void timeout(int sig);
+void batch_run(Window win);
+void command_wait(Window win, ucell atom, int secs);
+Window command_window();
 bool insert_command(ucell code, char* cmd);
+bool batch_send(Window win, autostr *ops, ucell count, ucell *lines);
+int script_words(char *line, char **words, int max);
+bool insert_script(char *path);
 ubyte setup_window(Window win, void *ptr);
 int main(int argc, char *argv[]);
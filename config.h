@@ -228,6 +228,8 @@ command commands[] = {
 		com_debug,           GF_TILING|GF_STACKING },
 	{ "quit", "^quit$",
 		com_quit,            GF_TILING|GF_STACKING },
+	{ "restart", "^restart$",
+		com_restart,         GF_TILING|GF_STACKING },
 };
 
 // clientmessage triggers commands, so these format strings need to
@@ -27,6 +27,8 @@
 #include "musca.h"
 #include "musca_proto.h"
 #include "config.h"
+// perfect hash tables over the names in config.h, built by phash.c
+#include "musca_names.h"
 
 void say(const char *fmt, ...)
 {
@@ -104,13 +106,19 @@ int error_callback(Display *dpy, XErrorEvent *ee)
 	return xerrorxlib(dpy, ee); /* may call exit */
 }
 // BINDINGS
+// each +separated part of names that is a modifier
 ucell modifier_names_to_mask(char *names)
 {
-	int i; ucell mod = 0;
-	modmask *m;
-	FOR_ARRAY (m, modmasks, modmask, i)
-		if (regexec(&m->re, names, 0, NULL, 0) == 0)
-			mod |= m->mask;
+	int i, len; ucell mod = 0;
+	char name[NOTE], *s = names;
+	while (*s)
+	{
+		len = strcspn(s, "+");
+		snprintf(name, NOTE, "%.*s", len, s);
+		if ((i = PHASH_FIND(name, musca_modmasks)) > -1)
+			mod |= modmasks[i].mask;
+		s += len; if (*s) s++;
+	}
 	return mod;
 }
 binding* find_binding(ucell mod, KeyCode key)
@@ -147,11 +155,15 @@ ubyte create_binding(char *pattern, char *command)
 	ucell mod; KeyCode code;
 	if (!process_binding(pattern, &mod, &code))
 		return 0;
-	if (!b) b = allocate(sizeof(binding));
+	// rebinding a pattern replaces its command in place
+	if (!b)
+	{
+		b = allocate(sizeof(binding));
+		stack_push(bindings, b);
+	}
 	strcpy(b->pattern, pattern);
 	strcpy(b->command, command);
 	b->mod = mod; b->key = code;
-	stack_push(bindings, b);
 	return 1;
 }
 ubyte remove_binding(char *pattern)
@@ -361,13 +373,6 @@ ubyte is_unmanaged_class(char *name)
 	}
 	return 0;
 }
-ubyte is_unmanaged_window(Window win)
-{
-	char name[NOTE];
-	window_class(win, name);
-	if (strcmp(name, MUSCA_CLASS) == 0) return 1;
-	return is_unmanaged_class(name);
-}
 ubyte window_on_screen(head *hd, Window win, XWindowAttributes *attr, int *x, int *y, int *w, int *h)
 {
 	XWindowAttributes _attr;
@@ -398,10 +403,10 @@ Window window_create(Window parent, int x, int y, int w, int h, ucell bw, char *
 }
 void window_stack(head *h, Window *list, int n)
 {
-	Window w; int i, wc = 0;
-	Window *wins = allocate(sizeof(Window) * (h->above->depth + h->fullscreen->depth + 1));
-	FOR_STACK (w, h->fullscreen, Window, i) wins[wc++] = w;
-	FOR_STACK (w, h->above, Window, i) wins[wc++] = w;
+	Window w; setlink *l; int wc = 0;
+	Window *wins = allocate(sizeof(Window) * (h->above->count + h->fullscreen->count + 1));
+	FOR_ORDSET (w, h->fullscreen, Window, l) wins[wc++] = w;
+	FOR_ORDSET (w, h->above, Window, l) wins[wc++] = w;
 	wins[wc++] = list[0];
 	XRaiseWindow(display, wins[0]);
 	if (wc > 1) XRestackWindows(display, wins, wc);
@@ -415,22 +420,18 @@ ubyte sanity_window(Window *tree, ucell n, Window w)
 		if (tree[i] == w) return 1;
 	return 0;
 }
-int sanity_stack(stack *s, Window *tree, ucell num)
+int sanity_set(ordset *s, Window *tree, ucell num)
 {
-	int found = 0;
-	if (s->depth)
+	int found = 0; Window w;
+	setlink *l = s->first, *next;
+	for (; l; l = next)
 	{
-		int *indexes = allocate(sizeof(int) * s->depth);
-		int count = 0, i; Window *w;
-		FOR_STACK (w, s, Window*, i)
+		next = l->next; w = (Window)l->item;
+		if (!sanity_window(tree, num, w))
 		{
-			note("%d", i);
-			if (!sanity_window(tree, num, *w))
-				indexes[count++] = i;
+			ordset_del(s, (void*)w);
+			found++;
 		}
-		found = count;
-		while (count > 0) stack_del(s, indexes[--count]);
-		free(indexes);
 	}
 	return found;
 }
@@ -455,11 +456,11 @@ void sanity_head(head *h)
 		}
 		FOR_STACK (c, destroy, client*, i) client_remove(c);
 		stack_free(destroy);
-		found = sanity_stack(h->above, tree, num);
+		found = sanity_set(h->above, tree, num);
 		note("above %d", found);
-		found = sanity_stack(h->below, tree, num);
+		found = sanity_set(h->below, tree, num);
 		note("below %d", found);
-		found = sanity_stack(h->fullscreen, tree, num);
+		found = sanity_set(h->fullscreen, tree, num);
 		note("fullscreen %d", found);
 	}
 	if (tree) XFree(tree);
@@ -471,14 +472,12 @@ void sanity_heads()
 }
 void window_discard_references(Window w)
 {
-	head *h; group *g; int i, j;
+	head *h; int i;
 	FOR_RING (NEXT, h, heads, i)
 	{
-		stack_discard(h->above, (void*)w);
-		stack_discard(h->below, (void*)w);
-		stack_discard(h->fullscreen, (void*)w);
-		FOR_RING (NEXT, g, h->groups, j)
-			stack_discard(g->stacked, (void*)w);
+		ordset_del(h->above, (void*)w);
+		ordset_del(h->below, (void*)w);
+		ordset_del(h->fullscreen, (void*)w);
 	}
 }
 // SEARCHES
@@ -520,13 +519,17 @@ client* client_hidden(frame *f, ubyte direction, ubyte local, ubyte prefer)
 	client *c, *m = NULL; int i; group *t = f->group;
 	if (prefer == RECENT)
 	{
-		FOR_STACK (c, t->stacked, client*, i)
+		// newest first, so at most one displayed client per frame is skipped
+		if (local)
 		{
-			if (c->flags & CF_SHRUNK) continue;
-			if (local && c->frame && c->frame == f && f->cli != c) m = c;
-			if (!local && (!c->frame || (c->frame->cli != c && !c->kids))) m = c;
+			FOR_MRU (c, f->recent, fnext, i)
+				if (!(c->flags & CF_SHRUNK) && f->cli != c) return c;
+		} else
+		{
+			FOR_MRU (c, t->recent, rnext, i)
+				if (!(c->flags & CF_SHRUNK) && (!c->frame || (c->frame->cli != c && !c->kids)))
+					return c;
 		}
-		if (m) return m;
 	}
 	FOR_RING (direction, c, t->clients, i)
 	{
@@ -648,7 +651,7 @@ ubyte ewmh_client_visible(client *c)
 void ewmh_clients()
 {
 	group *g = heads->groups, *o;
-	client *c, *f; int i, j, wc = 0, ws = 0;
+	client *c, *f; setlink *l; int i, j, wc = 0, ws = 0;
 	FOR_RING (NEXT, o, g->head->groups, i) FOR_RING (NEXT, c, o->clients, j) wc++;
 	Window *wins_all = allocate(sizeof(Window*)*wc);
 	Window *wins_stack = allocate(sizeof(Window*)*wc);
@@ -665,9 +668,9 @@ void ewmh_clients()
 			}
 		}
 	}
-	ws = 0; FOR_STACK (o, g->head->stacked, group*, i)
+	ws = 0; FOR_ORDSET (o, g->head->stacked, group*, l)
 	{
-		FOR_STACK (c, o->stacked, client*, j)
+		FOR_MRU (c, o->recent ? o->recent->rprev: NULL, rprev, j)
 		{
 			if (ewmh_client_visible(c))
 			{
@@ -708,7 +711,7 @@ void ewmh_groups()
 void client_configure(client *c, XConfigureRequestEvent *cr)
 {
 	XWindowAttributes attr;
-	Window trans = None;
+	Window trans = c->trans;
 	XSizeHints hints;
 	long userhints;
 	int x, y, w, h, pw, ph, b;
@@ -730,12 +733,11 @@ void client_configure(client *c, XConfigureRequestEvent *cr)
 		pw = f->w-fbw-fbw; ph = f->h-fbw-fbw;
 	}
 	w = pw; h = ph;
-	window_name(c->win, c->name);
-	window_class(c->win, c->class);
-	window_role(c->win, c->role);
+	// name, class, role and transient-for were snapshotted by manage() and are
+	// kept current by propertynotify()
 	dlen += sprintf(debug+dlen, "%s ", c->name);
 
-	if (!XGetTransientForHint(display, win, &trans) && trans == None && g->flags & GF_TILING)
+	if (trans == None && g->flags & GF_TILING)
 	{
 		// normal windows go full frame
 		dlen += sprintf(debug+dlen, "normal ");
@@ -825,11 +827,14 @@ void client_display(client *c, frame *target)
 	ubyte redraw = ((target && target != c->frame) ||
 		(c->frame && (c->frame->cli != c || c->frame->state != c->state))) ? 1:0;
 	note("%s", redraw ? "redraw": "skip");
-	if (target) c->frame = target;
+	if (target) client_attach(c, target);
 	if (c->frame) c->frame->cli = c;
 	c->state = c->frame->state;
 	if (redraw)
 	{
+		// windows still unmapped get their final geometry before XMapWindow, so
+		// need no border nudge to notice the new size
+		ubyte mapped = c->flags & CF_HIDDEN ? 0:1;
 		client_configure(c, NULL);
 		stack *family = stack_create();
 		client *ancestor = c, *relative; int i;
@@ -840,10 +845,9 @@ void client_display(client *c, frame *target)
 		Window *wins = allocate(sizeof(Window) * (family->depth + 1));
 		FOR_STACK (relative, family, client*, i)
 		{
-			client_show(relative);
 			if (relative->frame != c->frame)
 			{
-				relative->frame = c->frame;
+				client_attach(relative, c->frame);
 				relative->state = c->state - 1;
 			}
 			if (relative->state != c->state)
@@ -851,12 +855,13 @@ void client_display(client *c, frame *target)
 				client_configure(relative, NULL);
 				relative->state = c->state;
 			}
+			client_show(relative);
 			wins[i] = relative->win;
 		}
 		if (c->frame && c->group->flags & GF_TILING)
 			wins[i] = c->frame->win;
 		window_stack(c->group->head, wins, family->depth+1);
-		if (c->flags & CF_NORMAL)
+		if (mapped && !adopting && c->flags & CF_NORMAL)
 		{
 			XSetWindowBorderWidth(display, c->win, 1);
 			XSetWindowBorderWidth(display, c->win, 0);
@@ -890,9 +895,8 @@ void client_focus(client *c, frame *target)
 	client_display(c, target);
 	client_border(c, settings[ms_border_focus].s);
 	XSetInputFocus(display, c->input ? c->win: c->frame->win, RevertToPointerRoot, CurrentTime);
+	client_recent(c);
 	ewmh_clients();
-	stack_discard(c->group->stacked, c);
-	stack_push(c->group->stacked, c);
 }
 void client_raise(client *c)
 {
@@ -959,6 +963,75 @@ void client_kill(client *c)
 		c->flags |= CF_KILLED;
 	}
 }
+// focus order. groups and frames keep intrusive rings of recently focused
+// clients, newest first, so client_hidden() need not scan every client
+void client_frame_unlink(client *c)
+{
+	if (!c->fnext) return;
+	if (c->fnext == c) c->frame->recent = NULL;
+	else
+	{
+		c->fnext->fprev = c->fprev;
+		c->fprev->fnext = c->fnext;
+		if (c->frame->recent == c)
+			c->frame->recent = c->fnext;
+	}
+	c->fnext = NULL; c->fprev = NULL;
+}
+void client_frame_link(client *c)
+{
+	frame *f = c->frame;
+	if (!f || !c->rnext || c->fnext) return;
+	client *r = f->recent, *a = r;
+	if (!r)
+	{
+		f->recent = c->fnext = c->fprev = c;
+		return;
+	}
+	// keep the ring in focus order. usually c is the newest and lands in front
+	if (c->seq < r->seq)
+		for (a = r->fnext; a != r && a->seq > c->seq; a = a->fnext);
+	c->fnext = a; c->fprev = a->fprev;
+	a->fprev->fnext = c; a->fprev = c;
+	if (c->seq > r->seq) f->recent = c;
+}
+// all changes of c->frame go through here to keep the frame rings in step
+void client_attach(client *c, frame *f)
+{
+	if (c->frame == f) return;
+	client_frame_unlink(c);
+	c->frame = f;
+	client_frame_link(c);
+}
+void client_forget(client *c)
+{
+	client_frame_unlink(c);
+	if (!c->rnext) return;
+	group *t = c->group;
+	if (c->rnext == c) t->recent = NULL;
+	else
+	{
+		c->rnext->rprev = c->rprev;
+		c->rprev->rnext = c->rnext;
+		if (t->recent == c)
+			t->recent = c->rnext;
+	}
+	c->rnext = NULL; c->rprev = NULL;
+}
+void client_recent(client *c)
+{
+	group *t = c->group;
+	client_forget(c);
+	c->seq = ++focus_seq;
+	if (t->recent)
+	{
+		c->rnext = t->recent; c->rprev = t->recent->rprev;
+		t->recent->rprev->rnext = c; t->recent->rprev = c;
+	} else
+		c->rnext = c->rprev = c;
+	t->recent = c;
+	client_frame_link(c);
+}
 void client_push(group *t, client *c)
 {
 	c->group = t;
@@ -971,7 +1044,7 @@ void client_push(group *t, client *c)
 		c->prev = last; c->next = tmp;
 	} else
 		t->clients = c->next = c->prev = c;
-	if (!c->frame) c->frame = t->frames;
+	if (!c->frame) client_attach(c, t->frames);
 	c->state = 0;
 }
 void client_pop(client *c)
@@ -988,12 +1061,12 @@ void client_pop(client *c)
 	}
 	if (c->frame && c->frame->cli == c)
 		c->frame->cli = NULL;
+	client_forget(c);
 	c->frame = NULL;
 
 	client *n; int i;
 	FOR_RING (NEXT, n, t->clients, i)
 		if (n->id > c->id) n->id--;
-	stack_discard(c->group->stacked, c);
 }
 client* client_create(group *t, frame *f, Window win)
 {
@@ -1006,7 +1079,8 @@ client* client_create(group *t, frame *f, Window win)
 	c->x = 0; c->y = 0; c->w = 0; c->h = 0;
 	c->fx = 0; c->fy = 0; c->fw = 0; c->fh = 0;
 	c->rl = 0; c->rr = 0; c->rt = 0; c->rb = 0;
-	c->unmaps = 0; c->state = f->state - 1; c->input = True;
+	c->unmaps = 0; c->state = f->state - 1; c->input = True; c->trans = None;
+	c->seq = 0; c->rnext = NULL; c->rprev = NULL; c->fnext = NULL; c->fprev = NULL;
 	if (t) client_push(t, c);
 	return c;
 }
@@ -1015,7 +1089,6 @@ void client_destroy(client *c)
 	client_pop(c);
 	if (c->parent && is_valid_client(c->parent))
 		c->parent->kids--;
-	stack_discard(c->group->stacked, c);
 	free(c);
 }
 void client_regroup(group *g, client *c)
@@ -1063,7 +1136,7 @@ void frame_pop(frame *f)
 		if (n->id > f->id) n->id--;
 	FOR_RING (NEXT, c, t->clients, i)
 		if (c->frame && c->frame == f)
-			c->frame = t->frames;
+			client_attach(c, t->frames);
 }
 ucell frame_border_focus(frame *f)
 {
@@ -1094,7 +1167,7 @@ frame* frame_create(group *t, int x, int y, int w, int h)
 	frame *f = allocate(sizeof(frame));
 	f->x = x; f->y = y; f->w = w; f->h = h; f->flags = 0;
 	f->sx = 0; f->sy = 0; f->sw = 0; f->sh = 0;
-	f->group = NULL; f->cli = NULL; f->next = NULL; f->prev = NULL;
+	f->group = NULL; f->cli = NULL; f->next = NULL; f->prev = NULL; f->recent = NULL;
 	f->state = 1;
 	if (t) frame_push(t, f);
 	// frames have a background window, just for borders so far
@@ -1246,7 +1319,7 @@ void frame_target_client(frame *f, client *c)
 {
 	if (c->frame && c->frame->cli == c)
 		c->frame->cli = NULL;
-	f->cli = c; c->frame = f;
+	f->cli = c; client_attach(c, f);
 	c->state = f->state - 1;
 }
 void frame_focus_client(frame *f, client *c)
@@ -1262,7 +1335,7 @@ void frame_focus_client(frame *f, client *c)
 void frame_refocus_client(frame *f, client *c)
 {
 	client_unfocus(f->group->clients);
-	f->cli = c; c->frame = f;
+	f->cli = c; client_attach(c, f);
 	f->group->clients = c;
 	frame_focus(f);
 }
@@ -1769,6 +1842,25 @@ void frame_single(frame *f)
 	f->h = g->head->screen->height - g->b - g->t;
 	// don't do a frame update here in case frame is not in an active group
 }
+// fit a group's frames to its head's current screen size
+void group_rescale(group *g)
+{
+	int sw = g->head->screen->width, sh = g->head->screen->height;
+	if (g->sw == sw && g->sh == sh) return;
+	int ow = MAX(1, g->sw - g->l - g->r), oh = MAX(1, g->sh - g->t - g->b);
+	int nw = sw - g->l - g->r, nh = sh - g->t - g->b;
+	frame *f; int i; ubyte ok = 1;
+	FOR_RING (NEXT, f, g->frames, i)
+	{
+		int x = scale_edge(f->x - g->l, ow, nw), y = scale_edge(f->y - g->t, oh, nh);
+		f->w = scale_edge(f->x - g->l + f->w, ow, nw) - x;
+		f->h = scale_edge(f->y - g->t + f->h, oh, nh) - y;
+		f->x = g->l + x; f->y = g->t + y;
+		if (f->w < (int)settings[ms_frame_min_wh].u || f->h < (int)settings[ms_frame_min_wh].u) ok = 0;
+	}
+	g->sw = sw; g->sh = sh;
+	if (!ok) frame_single(g->frames);
+}
 char frames_overlap_y(frame *a, frame *b)
 {
 	return ((a->y <= b->y && (a->y + a->h) > b->y) || (b->y <= a->y && (b->y + b->h) > a->y))
@@ -1908,8 +2000,10 @@ group* group_create(head *head, char *name, int x, int y, int w, int h)
 	t->frames = NULL; t->clients = NULL; t->flags = GF_TILING;
 	t->head = NULL; t->next = NULL; t->prev = NULL;
 	t->l = 0; t->r = 0; t->t = 0; t->b = 0; t->id = 0;
-	strcpy(t->name, name); t->states = stack_create();
-	t->stacked = stack_create();
+	t->sw = head ? head->screen->width : x + w;
+	t->sh = head ? head->screen->height: y + h;
+	strcpy(t->name, name); t->states = deque_create();
+	t->recent = NULL;
 	if (head) group_push(head, t);
 	frame_create(t, x, y, w, h);
 	return t;
@@ -1924,11 +2018,10 @@ void group_destroy(group *t)
 	while (t->frames)
 		frame_destroy(t->frames);
 	while (t->states->depth)
-		free(stack_pop(t->states));
+		free(deque_pop(t->states));
 	group_pop(t);
-	stack_free(t->states);
-	stack_free(t->stacked);
-	stack_discard(h->stacked, t);
+	deque_free(t->states);
+	ordset_del(h->stacked, t);
 	free(t);
 }
 void group_unfocus(group *t)
@@ -1949,13 +2042,13 @@ void group_focus(group *t)
 {
 	frame *f; int i;
 	t->head->groups = t;
+	group_rescale(t);
 	FOR_RING (NEXT, f, t->frames, i)
 		frame_update(f);
 	frame_focus(t->frames);
 	ewmh_clients();
 	ewmh_groups();
-	stack_discard(t->head->stacked, t);
-	stack_push(t->head->stacked, t);
+	ordset_push(t->head->stacked, t);
 }
 void group_raise(group *g)
 {
@@ -1979,8 +2072,8 @@ void group_prev()
 }
 void group_other()
 {
-	if (heads->stacked->depth > 1)
-		group_raise(stack_get(heads->stacked, 1));
+	if (heads->stacked->count > 1)
+		group_raise(ordset_get(heads->stacked, 1));
 }
 // resize frames to match changes in the screen border padding
 void group_resize(group *ta, int l, int r, int t, int b)
@@ -2074,7 +2167,7 @@ void group_load(group *g, char *dump)
 			{
 				if (!c->frame && strcmp(c->class, class) == 0 && strcmp(c->role, role) == 0)
 				{
-					f->cli = c; c->frame = f;
+					f->cli = c; client_attach(c, f);
 					break;
 				}
 			}
@@ -2089,19 +2182,278 @@ void group_load(group *g, char *dump)
 }
 void group_track(group *g)
 {
-	if (g->states->depth == STACK)
-		free(stack_shift(g->states));
-	stack_push(g->states, group_dump(g));
+	if (g->states->depth == UNDO)
+		free(deque_shift(g->states));
+	deque_push(g->states, group_dump(g));
 }
 void group_undo(group *g)
 {
 	if (g->states->depth > 0)
 	{
-		char *layout = stack_pop(g->states);
+		char *layout = deque_pop(g->states);
 		group_load(g, layout); free(layout);
 	}
 	else	um("nothing to undo for %s", g->name);
 }
+// RESTART
+// serialize everything needed to pick up where we left off. one record per line,
+// tab separated. undo dumps are multi-line so are length prefixed.
+char* restart_dump()
+{
+	autostr s; str_create(&s);
+	head *h; group *g, *fg; frame *f, *ff; client *c, *fc; placement *p; hook *hk;
+	char *item, *block; setlink *l; int i, j, k;
+	str_print(&s, NOTE, "musca\t%d\n", RESTART_VERSION);
+	FOR_RING (NEXT, h, heads, i)
+	{
+		str_print(&s, NOTE, "head\t%d\n", h->id);
+		fg = group_first(h);
+		FOR_RING (NEXT, g, fg, j)
+		{
+			str_print(&s, NOTE, "group\t%d\t%u\t%d\t%d\t%d\t%d\t%s\n",
+				g == h->groups, g->flags, g->l, g->r, g->t, g->b, g->name);
+			ff = frame_first(g);
+			FOR_RING (NEXT, f, ff, k)
+				str_print(&s, NOTE, "frame\t%d\t%d\t%d\t%d\t%d\t%u\t%lu\n",
+					f == g->frames, f->x, f->y, f->w, f->h, f->flags,
+					f->cli && f->cli->frame == f ? f->cli->win: None);
+			fc = client_first(g);
+			FOR_RING (NEXT, c, fc, k)
+				str_print(&s, NOTE, "client\t%d\t%lu\t%d\t%u\t%lu\t%d\t%d\t%d\t%d\n",
+					c == g->clients, c->win, c->frame ? c->frame->id: -1, c->flags,
+					c->parent ? c->parent->win: None, c->fx, c->fy, c->fw, c->fh);
+			FOR_MRU (c, g->recent ? g->recent->rprev: NULL, rprev, k)
+				str_print(&s, NOTE, "stacked\t%lu\n", c->win);
+			FOR_DEQUE (item, g->states, char*, k)
+			{
+				str_print(&s, NOTE, "undo\t%u\n", strlen(item));
+				str_append(&s, item, strlen(item));
+				str_push(&s, '\n');
+			}
+		}
+		FOR_ORDSET (g, h->stacked, group*, l)
+			str_print(&s, NOTE, "recent\t%d\n", g->id);
+	}
+	// configuration is replayed as ordinary commands
+	block = show_settings(); item = strtok(block, "\n");
+	for (; item; item = strtok(NULL, "\n"))
+		str_print(&s, strlen(item) + NOTE, "command\t%s\n", item);
+	free(block);
+	block = show_bindings(); item = strtok(block, "\n");
+	for (; item; item = strtok(NULL, "\n"))
+		str_print(&s, strlen(item) + NOTE, "command\t%s\n", item);
+	free(block);
+	block = show_aliases(); item = strtok(block, "\n");
+	for (; item; item = strtok(NULL, "\n"))
+		str_print(&s, strlen(item) + NOTE, "command\t%s\n", item);
+	free(block);
+	FOR_STACK (item, unmanaged, char*, i)
+		str_print(&s, strlen(item) + NOTE, "command\tmanage off %s\n", item);
+	FOR_STACK (p, placements, placement*, i)
+		str_print(&s, NOTE * 3, "command\tplace %s on %s\n", p->class, p->group);
+	// com_hook() prepends, so replay hooks oldest first
+	stack *list = stack_create();
+	FOR_LIST (hk, hooks, i) stack_push(list, hk);
+	while (list->depth)
+	{
+		hk = stack_pop(list);
+		str_print(&s, strlen(hk->pattern) + strlen(hk->command) + NOTE,
+			"command\thook on %s %s\n", hk->pattern, hk->command);
+	}
+	stack_free(list);
+	return s.pad;
+}
+group* restart_group(head *h, int id)
+{
+	group *g; int i;
+	FOR_RING (NEXT, g, h->groups, i)
+		if (g->id == id) return g;
+	return NULL;
+}
+frame* restart_frame(group *g, int id)
+{
+	frame *f; int i;
+	FOR_RING (NEXT, f, g->frames, i)
+		if (f->id == id) return f;
+	return NULL;
+}
+// rebuild heads, groups, frames and clients from restart_dump(). windows that
+// vanished while we were away are skipped. returns 0 if dump is unusable.
+// check the record framing of a whole dump before restart_load() touches any state
+ubyte restart_valid(char *dump)
+{
+	char *line = dump, *l; ucell len;
+	if (strncmp(line, "musca\t", 6) != 0 || strtol(line+6, NULL, 10) != RESTART_VERSION)
+		return 0;
+	while (*line)
+	{
+		if (strncmp(line, "undo\t", 5) == 0)
+		{
+			len = strtoul(line+5, NULL, 10);
+			// the length prefixed payload starts on the next line
+			if (!(l = strchr(line, '\n')) || strlen(++l) < len) return 0;
+			line = l + len;
+		}
+		strscanthese(&line, "\n");
+		strskip(&line, isspace);
+	}
+	return 1;
+}
+ubyte restart_load(char *dump)
+{
+	char *line = dump, *l, *name; int i;
+	head *h = NULL; group *g = NULL, *current = NULL, *spare = NULL;
+	frame *f, *focus = NULL; client *c;
+	Window win, parent; int id, x, y, w, ht; ucell flags, len; ubyte cur;
+	if (!restart_valid(dump)) return 0;
+	stack *displayed = stack_create(), *parents = stack_create();
+	autostr cmds; str_create(&cmds);
+	while (*line)
+	{
+		l = line; name = strnextthese(&l, "\t\n"); strskip(&l, isspace);
+		if (strcmp(name, "head") == 0 || strcmp(name, "command") == 0)
+		{
+			// finish the previous head. its default group is replaced
+			if (h && spare && spare != current && h->groups->next != h->groups)
+				group_destroy(spare);
+			if (h && current) h->groups = current;
+			spare = NULL; current = NULL;
+		}
+		if (strcmp(name, "head") == 0)
+		{
+			id = strtol(l, &l, 10);
+			FOR_RING (NEXT, h, heads, i)
+				if (h->id == id) break;
+			if (h && h->id != id) h = NULL;
+			if (h) { spare = h->groups; ordset_clear(h->stacked); }
+			// records for an unknown head are dropped, not attached to the last one
+			g = NULL; focus = NULL;
+		} else
+		if (strcmp(name, "group") == 0 && h)
+		{
+			cur = strtol(l, &l, 10); strskip(&l, isspace);
+			flags = strtoul(l, &l, 10); strskip(&l, isspace);
+			int gl = strtol(l, &l, 10); strskip(&l, isspace);
+			int gr = strtol(l, &l, 10); strskip(&l, isspace);
+			int gt = strtol(l, &l, 10); strskip(&l, isspace);
+			int gb = strtol(l, &l, 10); strskip(&l, isspace);
+			char *gname = strnextthese(&l, "\n");
+			g = group_create(h, gname, 0, 0, h->screen->width, h->screen->height);
+			g->flags = flags; g->l = gl; g->r = gr; g->t = gt; g->b = gb;
+			while (g->frames) frame_destroy(g->frames);
+			if (cur) current = g;
+			free(gname); focus = NULL;
+			displayed->depth = 0;
+		} else
+		if (strcmp(name, "frame") == 0 && g)
+		{
+			cur = strtol(l, &l, 10); strskip(&l, isspace);
+			x = strtol(l, &l, 10); strskip(&l, isspace);
+			y = strtol(l, &l, 10); strskip(&l, isspace);
+			w = strtol(l, &l, 10); strskip(&l, isspace);
+			ht = strtol(l, &l, 10); strskip(&l, isspace);
+			flags = strtoul(l, &l, 10); strskip(&l, isspace);
+			win = strtoul(l, &l, 10);
+			f = frame_create(g, x, y, w, ht); f->flags = flags;
+			stack_push(displayed, (void*)win);
+			if (cur) focus = f;
+			if (focus) g->frames = focus;
+		} else
+		if (strcmp(name, "client") == 0 && g && g->frames)
+		{
+			cur = strtol(l, &l, 10); strskip(&l, isspace);
+			win = strtoul(l, &l, 10); strskip(&l, isspace);
+			id = strtol(l, &l, 10); strskip(&l, isspace);
+			flags = strtoul(l, &l, 10); strskip(&l, isspace);
+			parent = strtoul(l, &l, 10); strskip(&l, isspace);
+			winstate *ws = quiz_window(win);
+			if (ws->ok && !ws->c)
+			{
+				f = restart_frame(g, id);
+				c = client_create(g, f ? f: g->frames, win);
+				strcpy(c->name,  ws->name);
+				strcpy(c->class, ws->class);
+				strcpy(c->role,  ws->role);
+				c->input = ws->input; c->trans = ws->trans;
+				c->netwmstate = ws->state;
+				c->flags = flags & ~CF_KILLED;
+				c->fx = strtol(l, &l, 10); strskip(&l, isspace);
+				c->fy = strtol(l, &l, 10); strskip(&l, isspace);
+				c->fw = strtol(l, &l, 10); strskip(&l, isspace);
+				c->fh = strtol(l, &l, 10);
+				XSelectInput(display, win, PropertyChangeMask | EnterWindowMask | LeaveWindowMask);
+				if (cur) g->clients = c;
+				if (parent != None)
+				{
+					stack_push(parents, c);
+					stack_push(parents, (void*)parent);
+				}
+				// reattach the client displayed in its frame
+				for (i = 0; i < displayed->depth; i++)
+				{
+					if ((Window)displayed->items[i] == win && (f = restart_frame(g, i)))
+					{
+						f->cli = c; client_attach(c, f);
+					}
+				}
+			}
+			free(ws);
+		} else
+		if (strcmp(name, "stacked") == 0 && g)
+		{
+			win = strtoul(l, &l, 10);
+			if ((c = client_by_window(win)) && c->group == g)
+				client_recent(c);
+		} else
+		if (strcmp(name, "undo") == 0)
+		{
+			len = strtoul(l, &l, 10);
+			// restart_valid() has checked the payload is complete. it is skipped
+			// even without a group, so its lines are not read as records
+			l = strchr(line, '\n') + 1;
+			if (g) deque_push(g->states, strpull(l, len));
+			line = l + len;
+		} else
+		if (strcmp(name, "recent") == 0 && h)
+		{
+			// the spare default group still holds id 0 until this head is finished
+			id = strtol(l, &l, 10);
+			if ((g = restart_group(h, spare ? id+1: id)))
+				ordset_push(h->stacked, g);
+			g = NULL;
+		} else
+		if (strcmp(name, "command") == 0)
+		{
+			char *cmd = strnextthese(&l, "\n");
+			str_print(&cmds, strlen(cmd) + NOTE, "silent %s\n", cmd);
+			free(cmd);
+		}
+		free(name);
+		strscanthese(&line, "\n");
+		strskip(&line, isspace);
+	}
+	if (h && spare && spare != current && h->groups->next != h->groups)
+		group_destroy(spare);
+	if (h && current) h->groups = current;
+	// parents are resolved once every client exists
+	while (parents->depth)
+	{
+		parent = (Window)stack_pop(parents);
+		c = stack_pop(parents);
+		if ((c->parent = client_by_window(parent)))
+			c->parent->kids++;
+	}
+	stack_free(parents); stack_free(displayed);
+	// configuration replaces the compiled in defaults
+	binding *b; char *class;
+	FOR_STACK (b, bindings, binding*, i) free(b);
+	bindings->depth = 0;
+	FOR_STACK (class, unmanaged, char*, i) free(class);
+	unmanaged->depth = 0;
+	free(musca_commands(cmds.pad));
+	str_free(&cmds);
+	return 1;
+}
 void group_stack()
 {
 	group *g = heads->groups;
@@ -2551,7 +2903,7 @@ char* com_set(char *cmd, regmatch_t *subs)
 {
 	char *name = regsubstr(cmd, subs, 1);
 	char *value = regsubstr(cmd, subs, 2);
-	setting *s = hash_get(setting_hash, name);
+	setting *s = setting_find(name);
 	if (s && regmatch(s->check, value, 0, NULL, REG_EXTENDED|REG_ICASE) == 0)
 	{
 		switch (s->type)
@@ -2888,14 +3240,81 @@ char* com_quit(char *cmd, regmatch_t *subs)
 	shutdown();
 	return NULL;
 }
+char* com_restart(char *cmd, regmatch_t *subs)
+{
+	// hand our state to a fresh copy of the binary through an anonymous file that
+	// survives exec. clients are not our children and stay mapped throughout
+	char *dump = restart_dump(), arg[NOTE];
+	ucell len = strlen(dump);
+	int fd = memfd_create("musca", 0);
+	if (fd < 0 || write(fd, dump, len) != len || lseek(fd, 0, SEEK_SET) != 0)
+	{
+		um("could not save state for restart");
+		if (fd >= 0) close(fd);
+		free(dump);
+		return NULL;
+	}
+	free(dump);
+	snprintf(arg, NOTE, "%d", fd);
+	char *path = strchr(self, '=') + 1;
+	XCloseDisplay(display);
+	execlp(path, path, "-restore", arg, NULL);
+	crap("could not restart %s", path);
+	exit(EXIT_FAILURE);
+	return NULL;
+}
+ubyte restart_resume(char *arg)
+{
+	char name[NOTE]; ubyte ok = 0;
+	int fd = strtol(arg, NULL, 10);
+	snprintf(name, NOTE, "/proc/self/fd/%d", fd);
+	if (fd > 2 && access(name, R_OK) == 0)
+	{
+		char *dump = slurp(name, NULL);
+		ok = restart_load(dump);
+		free(dump);
+	}
+	if (fd > 2) close(fd);
+	if (!ok) crap("could not restore state, starting afresh");
+	return ok;
+}
 ubyte run_file(char *file)
 {
-	// should check file exists, but an empty stdin won't hurt musca -i
-	char tmp[NOTE];
-	snprintf(tmp, NOTE, "cat %s | $MUSCA -i", file);
-	exec_cmd(tmp);
+	// queue the file to be run in batches from the event loop. a nested run
+	// goes on top, so it executes before the rest of the file that called it
+	char path[BLOCK];
+	if (!file) return 0;
+	// the shell used to expand ~ for us
+	if (strncmp(file, "~/", 2) == 0 && getenv("HOME"))
+		snprintf(path, BLOCK, "%s%s", getenv("HOME"), file+1);
+	else	snprintf(path, BLOCK, "%s", file);
+	if (access(path, R_OK) != 0) return 0;
+	script *sc = allocate(sizeof(script));
+	sc->pad = slurp(path, NULL);
+	sc->pos = sc->pad;
+	stack_push(scripts, sc);
 	return 1;
 }
+void script_step()
+{
+	script *sc = stack_top(scripts);
+	char *end, *line; int i;
+	// a nested run ends the chunk, so the new file runs before the rest of this one
+	for (i = 0; *sc->pos && i < SCRIPT_BATCH && stack_top(scripts) == sc; i++)
+	{
+		end = sc->pos;
+		strscanthese(&end, "\n");
+		line = strpull(sc->pos, end - sc->pos);
+		sc->pos = *end ? end+1: end;
+		free(musca_commands(line));
+		free(line);
+	}
+	if (!*sc->pos)
+	{
+		stack_discard(scripts, sc);
+		free(sc->pad); free(sc);
+	}
+}
 char* musca_command(char *cmd_orig)
 {
 	int i;
@@ -2911,7 +3330,7 @@ char* musca_command(char *cmd_orig)
 		}
 		strskip(&cmd, isspace); char *first = cmd;
 		char *name = strnext(&first, isspace);
-		command *c = hash_get(command_hash, name);
+		command *c = command_find(name);
 		if (c)
 		{
 			matches++;
@@ -2975,38 +3394,34 @@ void group_switch()
 	menu_wrapper(list, settings[ms_switch_group].s);
 	free(list);
 }
-client* manage(Window win, XWindowAttributes *attr)
+client* manage(winstate *ws)
 {
 	client *c, *p;
-	head *h = head_by_screen(attr->screen);
-	Window trans = None;
+	head *h = head_by_screen(ws->attr.screen);
 	// transients use parent's frame even if it is dedicated
-	if (XGetTransientForHint(display, win, &trans) && (p = client_by_window(trans)))
+	if (ws->trans != None && (p = client_by_window(ws->trans)))
 	{
-		c = client_create(p->group, p->frame ? p->frame : p->group->frames, win);
+		c = client_create(p->group, p->frame ? p->frame : p->group->frames, ws->w);
 		c->parent = p; p->kids++;
 	} else
 	{
 		group *cg = h->groups;
 		frame *cf = NULL;
-		ubyte *data = NULL; ucell len;
 		placement *p; int i;
-		char class[NOTE]; window_class(win, class);
 		FOR_STACK (p, placements, placement*, i)
-			if (strcmp(p->class, class) == 0) break;
+			if (strcmp(p->class, ws->class) == 0) break;
 		if (i < placements->depth
 			&& (cg = group_auto_create(h, p->group)) != NULL);
 		else
 		// if we launched this app, and if it uses _NET_WM_PID, check to see
 		// if it was launched on a different group
-		if (atom_get(NetWMPid, win, &data, &len) && data && len)
+		if (ws->pid)
 		{
-			pid_t pid = *((pid_t*)data);
 			time_t limit = time(0) - EXEC_DELAY;
 			int i; struct exec_marker *em;
 			FOR_ARRAY (em, exec_markers, struct exec_marker, i)
 			{
-				if (em->pid == pid)
+				if (em->pid == ws->pid)
 				{
 					if (is_valid_group(em->group)) cg = em->group;
 					if (is_valid_frame(em->frame) && em->frame->group == cg) cf = em->frame;
@@ -3018,12 +3433,21 @@ client* manage(Window win, XWindowAttributes *attr)
 			FOR_ARRAY (em, exec_markers, struct exec_marker, i)
 				if (em->time < limit) em->pid = 0;
 		}
-		if (data) free(data);
 		if (!cf) cf = cg->frames;
-		c = client_create(cg, frame_available(cf), win);
+		c = client_create(cg, frame_available(cf), ws->w);
 	}
-	XSelectInput(display, win, PropertyChangeMask | EnterWindowMask | LeaveWindowMask);
-	atom_set(MuscaType, win, XA_STRING, 8, "client", 7);
+	// seed from the snapshot so the first configure needs no further round trips
+	strcpy(c->name,  ws->name);
+	strcpy(c->class, ws->class);
+	strcpy(c->role,  ws->role);
+	c->input = ws->input; c->trans = ws->trans;
+	c->netwmstate = ws->state;
+	XSelectInput(display, ws->w, PropertyChangeMask | EnterWindowMask | LeaveWindowMask);
+	atom_set(MuscaType, ws->w, XA_STRING, 8, "client", 7);
+	if (adopting)
+		// bulk adoption: attach only. find_clients() displays and publishes once
+		frame_target_client(c->frame, c);
+	else
 	if (c->frame->group == c->frame->group->head->groups)
 	{
 		if (c->frame == heads->groups->frames || settings[ms_window_open_focus].u)
@@ -3034,7 +3458,7 @@ client* manage(Window win, XWindowAttributes *attr)
 		// client is appearing on a hidden group.  attach to frame, but do nothing else
 		// as it will all happen in a later group_focus()
 		frame_target_client(c->frame, c);
-	ewmh_clients();
+	if (!adopting) ewmh_clients();
 	return c;
 }
 winstate* quiz_window(Window win)
@@ -3043,6 +3467,7 @@ winstate* quiz_window(Window win)
 	ws->w = win; ws->c = NULL; ws->f = NULL; ws->manage = 0;
 	ws->name[0] = '\0'; ws->class[0] = '\0';
 	ws->type = None; ws->state = 0;
+	ws->trans = None; ws->pid = 0;
 	if ((ws->ok = XGetWindowAttributes(display, win, &ws->attr)))
 	{
 		XWMHints *hints = XGetWMHints(display, win);
@@ -3055,16 +3480,21 @@ winstate* quiz_window(Window win)
 			strcpy(ws->name,  ws->c->name);
 			strcpy(ws->class, ws->c->class);
 			strcpy(ws->role,  ws->c->role);
-			ws->c->netwmstate = ws->state;
-			ws->c->input = ws->input;
+			ws->trans = ws->c->trans;
 		} else
 		{
 			window_name(ws->w,  ws->name);
 			window_class(ws->w, ws->class);
 			window_role(ws->w, ws->role);
+			XGetTransientForHint(display, win, &ws->trans);
 		}
 		ws->type  = window_type(win);
 		ws->state = window_state(win);
+		if (ws->c)
+		{
+			ws->c->netwmstate = ws->state;
+			ws->c->input = ws->input;
+		}
 		ws->manage = (
 			(ws->type != None
 				&& ws->type != atoms[NetWMWindowTypeNormal]
@@ -3074,7 +3504,16 @@ winstate* quiz_window(Window win)
 				&& ws->type != atoms[NetWMWindowTypeDialog])
 			|| is_netwmstate(ws->state, NetWMStateFullscreen)
 			|| is_netwmstate(ws->state, NetWMStateHidden)
-			|| is_unmanaged_window(win)) ? 0:1;
+			|| strcmp(ws->class, MUSCA_CLASS) == 0
+			|| is_unmanaged_class(ws->class)) ? 0:1;
+		// only a management candidate needs _NET_WM_PID for exec_marker lookup
+		if (ws->manage && !ws->c && !ws->f && !ws->attr.override_redirect)
+		{
+			ubyte *data = NULL; ucell len;
+			if (atom_get(NetWMPid, win, &data, &len) && data && len)
+				ws->pid = *((pid_t*)data);
+			free(data);
+		}
 		note("%s %s %s %s %s %s %x %x", ws->class, ws->name, ws->manage ? "manage": "ignore",
 			ws->input ? "focus": "nofocus", ws->c ? "client": "unknown",
 			ws->attr.override_redirect ? "override" : "normal", ws->state, ws->type);
@@ -3096,14 +3535,13 @@ void createnotify(XEvent *ev)
 void configurerequest(XEvent *ev)
 {
 	client *p;
-	Window trans = None;
 	XConfigureRequestEvent *cr = &ev->xconfigurerequest;
 	winstate *ws = quiz_window(cr->window); WINDOW_EVENT(ws);
 	if (ws->ok && !ws->attr.override_redirect)
 	{
 		if (ws->c)
 		{
-			if ((XGetTransientForHint(display, ws->w, &trans) && (p = client_by_window(trans)))
+			if ((ws->trans != None && (p = client_by_window(ws->trans)))
 				|| (ws->c->group != ws->c->group->head->groups))
 				client_configure(ws->c, cr);
 			else	client_refresh(ws->c);
@@ -3145,14 +3583,13 @@ void configurenotify(XEvent *ev)
 				note("screen %d %d %d", h->id, cn->width, cn->height);
 				h->screen->width = cn->width;
 				h->screen->height = cn->height;
-				group *g; int j;
-				FOR_RING (NEXT, g, h->groups, j)
-					frame_single(g->frames);
+				// hidden groups are rescaled by group_focus() when next shown
+				frame *f; int j;
+				group_rescale(h->groups);
+				FOR_RING (NEXT, f, h->groups->frames, j)
+					frame_update(f);
 				if (h == heads)
-				{
-					frame_update(h->groups->frames);
 					frame_focus(h->groups->frames);
-				}
 			}
 		}
 	}
@@ -3165,7 +3602,7 @@ client* handle_map(winstate *ws)
 	{
 		head *hd = head_by_root(ws->attr.root);
 		if (!ws->attr.override_redirect && !ws->c && ws->manage)
-			c = manage(ws->w, &ws->attr);
+			c = manage(ws);
 		else
 		{
 			int x, y, w, h;
@@ -3178,13 +3615,10 @@ client* handle_map(winstate *ws)
 void maprequest(XEvent *ev)
 {
 	winstate *ws = quiz_window(ev->xmaprequest.window); WINDOW_EVENT(ws);
+	// a newly managed client has already been configured to its frame and
+	// mapped by client_display(), or is waiting on a hidden group
 	client *c = handle_map(ws);
-	if (c)
-	{
-		free(ws);
-		ws = quiz_window(c->win);
-	}
-	if (ws->ok)
+	if (!c && ws->ok)
 	{
 		if (ws->c && ws->c->group != ws->c->group->head->groups)
 			say("map attempt on group %s", ws->c->group->name);
@@ -3200,10 +3634,10 @@ void mapnotify(XEvent *ev)
 		handle_map(ws);
 		head *h = head_by_root(ws->attr.root);
 		if (is_netwmstate(ws->state, NetWMStateFullscreen))
-			stack_push(h->fullscreen, (void*)ws);
+			ordset_push(h->fullscreen, (void*)ws->w);
 		else
 		if (ws->attr.override_redirect || is_netwmstate(ws->state, NetWMStateAbove))
-			stack_push(h->above, (void*)ws->w);
+			ordset_push(h->above, (void*)ws->w);
 	}
 	free(ws);
 }
@@ -3354,6 +3788,22 @@ void propertynotify(XEvent *ev)
 		client *c = client_by_window(pe->window);
 		if (c) window_name(c->win, c->name);
 	} else
+	if (pe->atom == XA_WM_TRANSIENT_FOR)
+	{
+		client *c = client_by_window(pe->window);
+		if (c && !XGetTransientForHint(display, c->win, &c->trans))
+			c->trans = None;
+	} else
+	if (pe->atom == atoms[WMClass])
+	{
+		client *c = client_by_window(pe->window);
+		if (c) window_class(c->win, c->class);
+	} else
+	if (pe->atom == atoms[WMRole])
+	{
+		client *c = client_by_window(pe->window);
+		if (c) window_role(c->win, c->role);
+	} else
 	if (pe->atom == atoms[MuscaCommand])
 	{
 		char *cmd = NULL; ucell len = 0; char *res = NULL;
@@ -3482,40 +3932,64 @@ ubyte insert_command(char* cmd)
 	free(result);
 	return 1;
 }
-void find_window(Window w, ubyte transient)
+ubyte adoptable(winstate *ws, ubyte transient)
 {
-	Window trans;
-	char *tmp = NULL; ucell len = 0;
-	winstate *ws = quiz_window(w);
-	if (ws->ok && !ws->attr.override_redirect && !ws->c && ws->manage)
+	char *tmp = NULL; ucell len = 0; ubyte ok = 0;
+	if (ws && ws->ok && !ws->attr.override_redirect && !ws->c && ws->manage
+		&& (transient ? ws->trans != None: ws->trans == None))
 	{
-		if (!transient && XGetTransientForHint(display, w, &trans))
-			return;
+		// an unmapped client from a previous session is picked up again
 		if (ws->attr.map_state == IsUnmapped)
 		{
-			atom_get_string(MuscaType, w, &tmp, &len);
-			if (tmp && strcmp(tmp, "client") == 0)
-			{
-				XMapWindow(display, w);
-				manage(w, &ws->attr);
-			}
+			atom_get_string(MuscaType, ws->w, &tmp, &len);
+			ok = tmp && strcmp(tmp, "client") == 0 ? 1:0;
 		} else
-		if (ws->attr.map_state == IsViewable)
-			manage(w, &ws->attr);
+			ok = ws->attr.map_state == IsViewable ? 1:0;
 	}
-	free(ws); free(tmp);
+	free(tmp);
+	return ok;
 }
 void find_clients(head *h)
 {
-	Window d1, d2, *wins = NULL; ucell num; int i;
-	// find any unmanaged running clients and manage them
+	Window d1, d2, *wins = NULL; ucell num; int i, pass;
+	ubyte was = adopting; client *c;
+	stack *viewable = stack_create();
+	// find any unmanaged running clients and manage them in bulk: each window is
+	// quizzed once, clients are only attached to frames, and display, focus and
+	// ewmh updates happen once at the end in group_focus(). the quiz is still one
+	// synchronous Xlib request per property; pipelining it would need XCB
 	if (XQueryTree(display, h->screen->root, &d1, &d2, &wins, &num))
 	{
-		// normals first
-		for (i = 0; i < num; i++) find_window(wins[i], 0);
-		for (i = 0; i < num; i++) find_window(wins[i], 1);
+		winstate **states = allocate(sizeof(winstate*) * (num+1));
+		// clients restored from a restart are already known
+		for (i = 0; i < num; i++)
+			states[i] = client_by_window(wins[i]) ? NULL: quiz_window(wins[i]);
+		adopting = 1;
+		// normals first, so transients can find their parents
+		for (pass = 0; pass < 2; pass++)
+		{
+			for (i = 0; i < num; i++)
+			{
+				winstate *ws = states[i];
+				if (!adoptable(ws, pass)) continue;
+				c = manage(ws);
+				if (ws->attr.map_state != IsViewable) continue;
+				// clients placed on another group must not stay visible
+				if (c->group != h->groups) client_hide(c);
+				else stack_push(viewable, c);
+			}
+		}
+		adopting = was;
+		for (i = 0; i < num; i++) free(states[i]);
+		free(states);
 		if(wins) XFree(wins);
 	}
+	group_focus(h->groups);
+	// several windows may have landed in one frame. group_focus() displayed only
+	// each frame's current client and its family, so unmap the others
+	FOR_STACK (c, viewable, client*, i)
+		if (is_valid_client(c) && c->flags & CF_HIDDEN) client_hide(c);
+	stack_free(viewable);
 }
 void ungrab_stuff()
 {
@@ -3544,34 +4018,15 @@ void grab_stuff()
 			True, ButtonPressMask, GrabModeSync, GrabModeSync, None, None);
 	}
 }
-void setup_regex()
+command* command_find(char *name)
 {
-	int i;
-	command_hash = hash_create();
-	command *c; autostr str; str_create(&str);
-	FOR_ARRAY (c, commands, command, i)
-	{
-		char *keys = c->keys;
-		while (keys && *keys)
-		{
-			char *tok = strnextthese(&keys, ",");
-			hash_set(command_hash, tok, c);
-			str_print(&str, NOTE, "%s \n", tok);
-			free(tok); strskipthese(&keys, ",");
-		}
-	}
-	command_hints = str.pad;
-	strtrim(command_hints);
-	// compile setting regex
-	setting_hash = hash_create();
-	setting *s;
-	FOR_ARRAY (s, settings, setting, i)
-		hash_set(setting_hash, s->name, s);
-	// compile modmask regex
-	modmask *m;
-	FOR_ARRAY (m, modmasks, modmask, i)
-		assert(regcomp(&m->re, m->pattern, REG_EXTENDED|REG_ICASE) == 0,
-			"could not compile modmask regex: %s", m->pattern);
+	int i = PHASH_FIND(name, musca_commands);
+	return i < 0 ? NULL: &commands[i];
+}
+setting* setting_find(char *name)
+{
+	int i = PHASH_FIND(name, musca_settings);
+	return i < 0 ? NULL: &settings[i];
 }
 void setup_numlock()
 {
@@ -3628,7 +4083,7 @@ void setup(int argc, char **argv)
 	}
 	for (i = 0; i < EXEC_MARKERS; i++)
 		exec_markers[i].pid = 0;
-	setup_regex();
+	command_hints = musca_commands_list;
 	// process args
 	char *arg = NULL;
 	arguments = args_to_hash(argc, argv);
@@ -3656,6 +4111,7 @@ void setup(int argc, char **argv)
 	// aliases
 	aliases = stack_create();
 	placements = stack_create();
+	scripts = stack_create();
 	// intialize all heads
 	f = NULL; p = NULL;
 	for (i = 0; i < ScreenCount(display); i++)
@@ -3665,11 +4121,11 @@ void setup(int argc, char **argv)
 		h->display_string = NULL;
 		h->prev = p; h->next = f;
 		h->groups = NULL;
-		h->stacked = stack_create();
+		h->stacked = ordset_create();
 
-		h->above = stack_create();
-		h->below = stack_create();
-		h->fullscreen = stack_create();
+		h->above = ordset_create();
+		h->below = ordset_create();
+		h->fullscreen = ordset_create();
 
 		if (!heads && DefaultScreen(display) == i) heads = h;
 		group_create(h, "default", 0, 0, h->screen->width, h->screen->height);
@@ -3690,9 +4146,11 @@ void setup(int argc, char **argv)
 	f->prev = p; p->next = f;
 	// none of below can be moved above as it requires the head linked list ring to be intact,
 	// which it isn't until just now :-)
+	// after a restart, only windows mapped while no wm was running need probing
+	ubyte restored = (arg = hash_get(arguments, "restore")) ? restart_resume(arg): 0;
+	adopting = restored;
 	h = heads;
 	do {
-		group_focus(heads->groups);
 		char *ds = allocate(NOTE);
 		sprintf(ds, "DISPLAY=%s", DisplayString(display));
 		if (strrchr(DisplayString(display), ':'))
@@ -3704,6 +4162,7 @@ void setup(int argc, char **argv)
 		find_clients(heads);
 		head_next();
 	} while (heads != h);
+	adopting = 0;
 	group_focus(heads->groups);
 	FOR_RING (NEXT, h, heads, i)
 	{
@@ -3715,8 +4174,9 @@ void setup(int argc, char **argv)
 	ewmh_clients();
 	grab_stuff();
 	//sanity_heads();
-	// process startup file asyncronously so main thread can respond to events
-	run_file(settings[ms_startup].s);
+	// process startup file asyncronously so main thread can respond to events.
+	// a restart carried the configuration over already
+	if (!restored) run_file(settings[ms_startup].s);
 }
 /**/void (*handler[LASTEvent])(XEvent*) = {
 	[KeyPress] = keypress,
@@ -3772,6 +4232,12 @@ int main(int argc, char **argv)
 				//sanity_heads();
 				sanity = 0;
 			}
+			// interleave queued script batches with event handling
+			if (scripts->depth)
+			{
+				script_step();
+				if (!XPending(display)) continue;
+			}
 			XNextEvent(display, &ev);
 			process_event(&ev);
 		}
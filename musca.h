@@ -25,6 +25,7 @@
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
+#include <sys/mman.h>
 
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 
@@ -167,6 +168,8 @@ typedef struct _frame {
 	ubyte flags;
 	ucell state;
 	int sx, sy, sw, sh;
+	// most recently focused client in this frame
+	struct _client *recent;
 	struct _frame *next;
 	struct _frame *prev;
 } frame;
@@ -180,6 +183,8 @@ typedef struct _frame {
 
 #define FOR_RING(d,v,f,i) for ((v) = (f), (i) = 0; (f) && (v) && (!(i) || (v) != (f)); (v) = (d) ? (v)->next: (v)->prev, (i)++)
 #define FOR_LIST(v,f,i) for ((v) = (f), (i) = 0; (f) && (v); (v) = (v)->next, (i)++)
+// walk an intrusive mru ring through link field n
+#define FOR_MRU(v,f,n,i) for ((v) = (f), (i) = 0; (f) && (v) && (!(i) || (v) != (f)); (v) = (v)->n, (i)++)
 
 enum { ANY, RECENT };
 
@@ -204,9 +209,15 @@ typedef struct _client {
 	ucell state;
 	ucell netwmstate;
 	Bool input;
+	Window trans;
 	struct _client *parent;
 	struct _client *next;
 	struct _client *prev;
+	// focus order. rnext is older, rprev newer, within the group and within
+	// c->frame. only clients focused in their current group are linked
+	ucell seq;
+	struct _client *rnext, *rprev;
+	struct _client *fnext, *fprev;
 } client;
 
 #define CF_HIDDEN 1
@@ -217,19 +228,25 @@ typedef struct _client {
 
 #define CF_INITIAL (CF_HIDDEN)
 
+// undo dumps kept per group
+#define UNDO 32
+
 typedef struct _group {
 	int id;
 	frame *frames;
 	client *clients;
 	int l, r, t, b;
+	// screen size the frames were laid out for; see group_rescale()
+	int sw, sh;
 	char name[32];
-	stack *states;
+	// undo dumps, oldest first
+	deque *states;
 	ubyte flags;
 	struct _head *head;
 	struct _group *next;
 	struct _group *prev;
-	// client stack order
-	stack *stacked;
+	// most recently focused client. see client_recent()
+	client *recent;
 } group;
 
 #define GF_TILING 1
@@ -240,13 +257,13 @@ typedef struct _head {
 	Screen *screen;
 	group *groups;
 	char *display_string;
-	stack *above;
-	stack *below;
-	stack *fullscreen;
+	ordset *above;
+	ordset *below;
+	ordset *fullscreen;
 	struct _head *next;
 	struct _head *prev;
 	// group stack order
-	stack *stacked;
+	ordset *stacked;
 	Window ewmh;
 } head;
 
@@ -270,7 +287,6 @@ struct frame_match {
 typedef struct _modmask {
 	char *pattern;
 	ucell mask;
-	regex_t re;
 } modmask;
 
 typedef struct _keymap {
@@ -294,7 +310,7 @@ typedef struct _command {
 	ubyte flags;
 	regex_t re;
 } command;
-hash *command_hash;
+// names of all commands, from the generated musca_names.h
 char *command_hints;
 
 stack *unmanaged;
@@ -319,7 +335,6 @@ typedef struct _setting {
 	char *check;
 	regex_t re;
 } setting;
-hash *setting_hash;
 
 enum { mst_str, mst_ucell, mst_dcell };
 ucell NumlockMask;
@@ -337,6 +352,8 @@ typedef struct {
 	Atom type;
 	ucell state;
 	Bool input;
+	Window trans;
+	pid_t pid;
 } winstate;
 
 #define WINDOW_EVENT(ws) note("%s", (ws)->class)
@@ -350,6 +367,10 @@ typedef struct _alias {
 stack *aliases;
 
 ubyte silent;
+// set while find_clients() adopts existing windows in bulk, or restart_load() restores them
+ubyte adopting;
+
+#define RESTART_VERSION 1
 
 typedef struct _hook {
 	regex_t re;
@@ -381,5 +402,15 @@ typedef struct {
 } placement;
 stack *placements;
 
+// files queued by run_file(), executed by script_step() from the event loop
+typedef struct {
+	char *pad;
+	char *pos;
+} script;
+stack *scripts;
+#define SCRIPT_BATCH 16
+
+ucell focus_seq;
+
 bool sanity;
 hash *arguments;
@@ -22,11 +22,10 @@ void window_role(Window win, char *pad);
 ubyte is_netwmstate(ucell state, ucell atom);
 ucell window_state(Window win);
 ubyte is_unmanaged_class(char *name);
-ubyte is_unmanaged_window(Window win);
 ubyte window_on_screen(head *hd, Window win, XWindowAttributes *attr, int *x, int *y, int *w, int *h);
 void window_stack(head *h, Window *list, int n);
 ubyte sanity_window(Window *tree, ucell n, Window w);
-int sanity_stack(stack *s, Window *tree, ucell num);
+int sanity_set(ordset *s, Window *tree, ucell num);
 void sanity_head(head *h);
 void sanity_heads();
 void window_discard_references(Window w);
@@ -64,6 +63,11 @@ void client_hide(client *c);
 void client_shrink(client *c);
 void client_remove(client *c);
 void client_kill(client *c);
+void client_frame_unlink(client *c);
+void client_frame_link(client *c);
+void client_attach(client *c, frame *f);
+void client_forget(client *c);
+void client_recent(client *c);
 void client_push(group *t, client *c);
 void client_pop(client *c);
 client* client_create(group *t, frame *f, Window win);
@@ -109,6 +113,7 @@ void frame_remove();
 ubyte frame_shrink(ubyte direction, ubyte adapt, ucell size);
 ubyte frame_grow(ubyte direction, ubyte adapt, ucell size);
 void frame_single(frame *f);
+void group_rescale(group *g);
 char frames_overlap_y(frame *a, frame *b);
 char frames_overlap_x(frame *a, frame *b);
 frame* frame_relative(frame *f, ubyte side);
@@ -140,6 +145,11 @@ char* group_dump(group *g);
 void group_load(group *g, char *dump);
 void group_track(group *g);
 void group_undo(group *g);
+char* restart_dump();
+group* restart_group(head *h, int id);
+frame* restart_frame(group *g, int id);
+ubyte restart_valid(char *dump);
+ubyte restart_load(char *dump);
 void group_stack();
 void head_focus(head *h);
 void head_next();
@@ -200,12 +210,15 @@ char* com_client(char *cmd, regmatch_t *subs);
 char* com_place(char *cmd, regmatch_t *subs);
 char* com_debug(char *cmd, regmatch_t *subs);
 char* com_quit(char *cmd, regmatch_t *subs);
+char* com_restart(char *cmd, regmatch_t *subs);
+ubyte restart_resume(char *arg);
 ubyte run_file(char *file);
+void script_step();
 char* musca_command(char *cmd_orig);
 char* musca_commands(char *content);
 void window_switch();
 void group_switch();
-client* manage(Window win, XWindowAttributes *attr);
+client* manage(winstate *ws);
 winstate* quiz_window(Window win);
 void createnotify(XEvent *ev);
 void configurerequest(XEvent *ev);
@@ -228,11 +241,12 @@ void focusout(XEvent *ev);
 void leavenotify(XEvent *ev);
 void timeout(int sig);
 ubyte insert_command(char* cmd);
-void find_window(Window w, ubyte transient);
+ubyte adoptable(winstate *ws, ubyte transient);
 void find_clients(head *h);
 void ungrab_stuff();
 void grab_stuff();
-void setup_regex();
+command* command_find(char *name);
+setting* setting_find(char *name);
 void setup_numlock();
 void setup_bindings();
 void setup_unmanaged();
@@ -0,0 +1,160 @@
+/*
+  This file is part of Musca.
+
+  Musca is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as publishead by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Musca is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Musca.  If not, see <http://www.gnu.org/licenses/>.
+
+  Sean Pringle
+  sean dot pringle at gmail dot com
+  https://launchpad.net/musca
+*/
+
+// build time generator for perfect hash tables over the static name arrays.
+//   phash <file> <array> <prefix>
+// scans <file> for "<array>[] = {", takes the first string literal of each entry
+// (split on commas, as musca command keys are) and writes to stdout a table that
+// maps every name to its entry index with no collisions. see phash.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "phash.h"
+
+#define NAMES 1024
+
+char *names[NAMES];
+int entries[NAMES];
+int count = 0;
+
+char* slurp(char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *pad = malloc(len+1);
+	if (fread(pad, 1, len, f) != len) len = 0;
+	pad[len] = '\0';
+	fclose(f);
+	return pad;
+}
+void add_names(char *csv, int len, int entry)
+{
+	char *s = csv, *end = csv + len;
+	while (s < end && count < NAMES)
+	{
+		char *e = s;
+		while (e < end && *e != ',') e++;
+		if (e > s)
+		{
+			names[count] = strndup(s, e - s);
+			entries[count++] = entry;
+		}
+		s = e + 1;
+	}
+}
+// walk the array initializer, skipping comments and the contents of later literals
+int scan(char *src, char *array)
+{
+	char pattern[256]; snprintf(pattern, sizeof(pattern), "%s[] = {", array);
+	char *s = strstr(src, pattern);
+	if (!s) return 0;
+	s += strlen(pattern);
+	int depth = 1, entry = -1, named = 0;
+	while (*s && depth > 0)
+	{
+		if (s[0] == '/' && s[1] == '/')
+		{
+			while (*s && *s != '\n') s++;
+			continue;
+		}
+		if (*s == '{' && ++depth == 2) { entry++; named = 0; }
+		if (*s == '}') depth--;
+		if (*s == '"')
+		{
+			char *start = ++s;
+			while (*s && *s != '"') s += (*s == '\\' && s[1]) ? 2: 1;
+			if (depth == 2 && !named)
+			{
+				add_names(start, s - start, entry);
+				named = 1;
+			}
+		}
+		if (*s) s++;
+	}
+	return entry + 1;
+}
+int main(int argc, char *argv[])
+{
+	int i, j;
+	if (argc != 4)
+	{
+		fprintf(stderr, "usage: phash <file> <array> <prefix>\n");
+		return EXIT_FAILURE;
+	}
+	char *src = slurp(argv[1]);
+	if (!src || !scan(src, argv[2]) || !count)
+	{
+		fprintf(stderr, "phash: no %s[] in %s\n", argv[2], argv[1]);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < count; i++)
+	for (j = 0; j < i; j++)
+		if (strcasecmp(names[i], names[j]) == 0)
+		{
+			fprintf(stderr, "phash: duplicate name %s in %s[]\n", names[i], argv[2]);
+			return EXIT_FAILURE;
+		}
+	// at most half full, doubling whenever no seed separates the names
+	unsigned int size = 8, seed = 0, tries;
+	while (size < count * 2) size *= 2;
+	short *slots = NULL;
+	for (;;)
+	{
+		slots = realloc(slots, sizeof(short) * size);
+		for (tries = 0; tries < 100000; tries++, seed++)
+		{
+			memset(slots, 0, sizeof(short) * size);
+			for (i = 0; i < count; i++)
+			{
+				unsigned int k = phash_code(names[i], seed) & (size-1);
+				if (slots[k]) break;
+				slots[k] = i + 1;
+			}
+			if (i == count) break;
+		}
+		if (i == count) break;
+		size *= 2;
+	}
+	printf("// generated by phash from %s %s[]; do not edit\n", argv[1], argv[2]);
+	printf("unsigned int %s_seed = %uU, %s_mask = %u;\n", argv[3], seed, argv[3], size-1);
+	printf("short %s_slots[%u] = {", argv[3], size);
+	for (i = 0; i < size; i++)
+		printf("%s%d", !i ? "\n\t": i % 16 ? ", ": ",\n\t", slots[i] ? entries[slots[i]-1] + 1: 0);
+	printf("\n};\nchar *%s_keys[%u] = {", argv[3], size);
+	for (i = 0; i < size; i++)
+	{
+		printf("%s", !i ? "\n\t": i % 4 ? ", ": ",\n\t");
+		if (slots[i]) printf("\"%s\"", names[slots[i]-1]);
+		else printf("NULL");
+	}
+	// every name, in source order
+	printf("\n};\nchar %s_list[] =", argv[3]);
+	for (i = 0; i < count; i++)
+		printf("\n\t\"%s%s\"", names[i], i < count-1 ? " \\n": "");
+	printf(";\n");
+	return EXIT_SUCCESS;
+}
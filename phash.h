@@ -0,0 +1,36 @@
+/*
+  This file is part of Musca.
+
+  Musca is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as publishead by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Musca is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Musca.  If not, see <http://www.gnu.org/licenses/>.
+
+  Sean Pringle
+  sean dot pringle at gmail dot com
+  https://launchpad.net/musca
+*/
+
+// case insensitive string hash shared by the phash generator and the tables it writes
+unsigned int phash_code(const char *s, unsigned int seed)
+{
+	unsigned int c = 2166136261U ^ seed;
+	while (*s) c = (c ^ (unsigned char)tolower(*s++)) * 16777619U;
+	c ^= c >> 15;
+	return c;
+}
+// index of name in the source array, or -1. a generated table p is looked up with PHASH_FIND(name, p)
+int phash_find(const char *name, unsigned int seed, unsigned int mask, short *slots, char **keys)
+{
+	unsigned int i = phash_code(name, seed) & mask;
+	return keys[i] && strcasecmp(keys[i], name) == 0 ? slots[i] - 1: -1;
+}
+#define PHASH_FIND(name,p) phash_find((name), p##_seed, p##_mask, p##_slots, p##_keys)
@@ -240,19 +240,22 @@ ucell suck(FILE *src, byte *pad, ucell len, byte stop)
 }
 byte* slurp(const char *name, ucell *len)
 {
-	ucell blocks = 0;
 	FILE *f = fopen(name, "r");
 	assert(f, "file open failed: %s", name);
-	byte *pad = (byte*)allocate(BLOCK);
-	ucell read = 0;
-	for (;;)
+	ucell lim = BLOCK, used = 0, got = 0;
+	byte *pad = (byte*)allocate(lim+1);
+	// buffered block reads, doubling the pad as needed
+	while ((got = fread(pad+used, sizeof(byte), lim-used, f)) > 0)
 	{
-		read = suck(f, pad+(BLOCK*blocks), BLOCK, EOF);
-		if (read < BLOCK) break;
-		pad = reallocate(pad, BLOCK * (++blocks+1));
+		used += got;
+		if (used == lim)
+		{
+			lim *= 2;
+			pad = reallocate(pad, lim+1);
+		}
 	}
-	pad[BLOCK * blocks + read] = '\0';
-	if (len) *len = BLOCK * blocks + read;
+	pad[used] = '\0';
+	if (len) *len = used;
 	fclose(f);
 	return pad;
 }
@@ -301,7 +304,7 @@ void stack_shove(stack *s, void *item)
 void stack_del(stack *s, ucell index)
 {
 	assert(index < s->depth, "invalid stack item");
-	memmove(&(s->items[index]), &(s->items[index+1]), (s->depth - index) * sizeof(void*));
+	memmove(&(s->items[index]), &(s->items[index+1]), (s->depth - index - 1) * sizeof(void*));
 	s->depth--;
 }
 int stack_find(stack *s, void *item)
@@ -329,114 +332,323 @@ void stack_free(stack *s)
 	free(s->items);
 	free(s);
 }
-hash* hash_create()
+deque* deque_create()
 {
-	int i;
-	hash *h = (hash*)allocate(sizeof(hash));
-	for (i = 0; i < HASH; i++)
-		h->chains[i] = NULL;
+	deque *d = allocate(sizeof(deque));
+	d->items = allocate(sizeof(void*) * DEQUE);
+	d->limit = DEQUE; d->first = 0; d->depth = 0;
+	return d;
+}
+// unwrap into a buffer twice the size
+void deque_grow(deque *d)
+{
+	void **items = allocate(sizeof(void*) * d->limit * 2); ucell i;
+	for (i = 0; i < d->depth; i++) items[i] = DEQUE_AT(d, i);
+	free(d->items);
+	d->items = items; d->limit *= 2; d->first = 0;
+}
+void deque_push(deque *d, void *item)
+{
+	if (d->depth == d->limit) deque_grow(d);
+	DEQUE_AT(d, d->depth) = item; d->depth++;
+}
+void* deque_pop(deque *d)
+{
+	assert(d->depth > 0, "deque underflow");
+	d->depth--;
+	return DEQUE_AT(d, d->depth);
+}
+void deque_shove(deque *d, void *item)
+{
+	if (d->depth == d->limit) deque_grow(d);
+	d->first = (d->first - 1) & (d->limit - 1); d->depth++;
+	DEQUE_AT(d, 0) = item;
+}
+void* deque_shift(deque *d)
+{
+	assert(d->depth > 0, "deque underflow");
+	void *item = DEQUE_AT(d, 0);
+	d->first = (d->first + 1) & (d->limit - 1); d->depth--;
+	return item;
+}
+void deque_free(deque *d)
+{
+	free(d->items);
+	free(d);
+}
+hash* hash_create_mode(ubyte mode)
+{
+	hash *h = allocate(sizeof(hash));
+	h->buckets = allocate(sizeof(bucket) * HASH);
+	memset(h->buckets, 0, sizeof(bucket) * HASH);
+	h->limit = HASH; h->count = 0; h->mode = mode;
 	return h;
 }
-ubyte hash_index(char *s)
+// keys are case insensitive unless created with HASH_CASE
+hash* hash_create()
 {
-	ucell h = 0, i = 0;
-	while (s[i])
-		h = 33 * h + tolower(s[i++]);
-	return h % HASH;
+	return hash_create_mode(HASH_NOCASE);
 }
-bucket* hash_find(hash *h, char *key)
+ucell hash_code(hash *h, char *s)
 {
-	ubyte index = hash_index(key);
-	bucket *b = h->chains[index];
-	while (b)
+	ucell c = 2166136261U;
+	if (h->mode == HASH_NOCASE)
+		while (*s) c = (c ^ (ubyte)tolower(*s++)) * 16777619U;
+	else
+		while (*s) c = (c ^ (ubyte)*s++) * 16777619U;
+	return c;
+}
+// probe from the home slot; the cached code avoids most string compares
+ucell hash_slot(hash *h, char *key, ucell code)
+{
+	ucell i = code & (h->limit - 1);
+	while (h->buckets[i].key)
 	{
-		if (strcasecmp(key, b->key) == 0)
-			return b;
-		b = b->next;
+		bucket *b = &h->buckets[i];
+		if (b->code == code && (h->mode == HASH_NOCASE
+			? strcasecmp(key, b->key): strcmp(key, b->key)) == 0)
+			break;
+		i = (i + 1) & (h->limit - 1);
 	}
-	return NULL;
+	return i;
+}
+// valid until the next hash_set() or hash_del()
+bucket* hash_find(hash *h, char *key)
+{
+	bucket *b = &h->buckets[hash_slot(h, key, hash_code(h, key))];
+	return b->key ? b: NULL;
 }
 void* hash_get(hash *h, char *key)
 {
 	bucket *b = hash_find(h, key);
 	return b ? b->val: NULL;
 }
+void hash_grow(hash *h)
+{
+	bucket *old = h->buckets; ucell i, limit = h->limit;
+	h->limit *= 2;
+	h->buckets = allocate(sizeof(bucket) * h->limit);
+	memset(h->buckets, 0, sizeof(bucket) * h->limit);
+	// codes are kept, so rehashing moves entries without touching keys
+	for (i = 0; i < limit; i++)
+	{
+		if (!old[i].key) continue;
+		ucell j = old[i].code & (h->limit - 1);
+		while (h->buckets[j].key) j = (j + 1) & (h->limit - 1);
+		h->buckets[j] = old[i];
+	}
+	free(old);
+}
+// vals may be NULL; a key is present until hash_del()
 void* hash_set(hash *h, char *key, void *val)
 {
-	ubyte index = hash_index(key);
-	bucket *b = h->chains[index];
-	void* old = NULL;
-	while (b)
+	if ((h->count + 1) * 4 > h->limit * 3) hash_grow(h);
+	ucell code = hash_code(h, key);
+	bucket *b = &h->buckets[hash_slot(h, key, code)];
+	if (b->key)
 	{
-		if (strcasecmp(key, b->key) == 0)
-		{
-			old = b->val;
-			b->val = val;
-			return old;
-		}
-		b = b->next;
+		void *old = b->val;
+		b->val = val;
+		return old;
 	}
-	b = allocate(sizeof(bucket));
 	b->key = strdup(key);
-	b->val = val;
-	b->next = h->chains[index];
-	h->chains[index] = b;
-	return old;
+	b->val = val; b->code = code;
+	h->count++;
+	return NULL;
 }
 void* hash_del(hash *h, char *key)
 {
-	ubyte index = hash_index(key);
-	bucket *b = h->chains[index], *l = b;
-	void *old = NULL;
-	while (b)
+	bucket *b = hash_find(h, key);
+	if (!b) return NULL;
+	void *old = b->val;
+	ucell mask = h->limit - 1, i = b - h->buckets, j = i, home;
+	free(b->key);
+	// backward shift, as table_del()
+	for (;;)
 	{
-		if (strcasecmp(key, b->key) == 0)
+		h->buckets[i].key = NULL;
+		for (;;)
 		{
-			if (l == h->chains[index])
-				h->chains[index] = b->next;
-			else	l->next = b->next;
-			old = b->val;
-			free(b->key);
-			free(b);
-			return old;
+			j = (j + 1) & mask;
+			if (!h->buckets[j].key) { h->count--; return old; }
+			home = h->buckets[j].code & mask;
+			if (i <= j ? (i < home && home <= j): (i < home || home <= j))
+				continue;
+			break;
 		}
-		l = b;
-		b = b->next;
+		h->buckets[i] = h->buckets[j];
+		i = j;
 	}
-	return old;
 }
 void hash_free(hash *h, bool vals)
 {
-	int i; bucket *b, *n;
-	for (i = 0; i < HASH; i++)
+	ucell i; bucket *b;
+	FOR_HASH (b, h, i)
+	{
+		free(b->key);
+		if (vals) free(b->val);
+	}
+	free(h->buckets);
+	free(h);
+}
+// do not hash_set() or hash_del() from the callback
+void hash_iterate(hash *h, void (*cb)(hash*, char*, void *val))
+{
+	ucell i; bucket *b;
+	FOR_HASH (b, h, i)
+		cb(h, b->key, b->val);
+}
+table* table_create()
+{
+	table *t = allocate(sizeof(table));
+	t->slots = allocate(sizeof(slot) * TABLE);
+	memset(t->slots, 0, sizeof(slot) * TABLE);
+	t->limit = TABLE; t->count = 0;
+	return t;
+}
+// limit is always a power of two
+ucell table_index(table *t, ulcell key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key & (t->limit - 1);
+}
+slot* table_find(table *t, ulcell key)
+{
+	ucell i = table_index(t, key);
+	while (t->slots[i].val)
+	{
+		if (t->slots[i].key == key)
+			return &t->slots[i];
+		i = (i + 1) & (t->limit - 1);
+	}
+	return NULL;
+}
+void* table_get(table *t, ulcell key)
+{
+	slot *s = table_find(t, key);
+	return s ? s->val: NULL;
+}
+void table_grow(table *t)
+{
+	slot *old = t->slots; ucell i, limit = t->limit;
+	t->limit *= 2; t->count = 0;
+	t->slots = allocate(sizeof(slot) * t->limit);
+	memset(t->slots, 0, sizeof(slot) * t->limit);
+	for (i = 0; i < limit; i++)
+		if (old[i].val) table_set(t, old[i].key, old[i].val);
+	free(old);
+}
+void* table_set(table *t, ulcell key, void *val)
+{
+	void *old = NULL;
+	if (!val) return table_del(t, key);
+	// keep load under 3/4 so probe runs stay short
+	if ((t->count + 1) * 4 > t->limit * 3) table_grow(t);
+	ucell i = table_index(t, key);
+	while (t->slots[i].val)
 	{
-		b = h->chains[i];
-		while (b)
+		if (t->slots[i].key == key)
 		{
-			n = b->next;
-			free(b->key);
-			if (vals) free(b->val);
-			free(b);
-			b = n;
+			old = t->slots[i].val;
+			t->slots[i].val = val;
+			return old;
 		}
+		i = (i + 1) & (t->limit - 1);
 	}
+	t->slots[i].key = key;
+	t->slots[i].val = val;
+	t->count++;
+	return old;
 }
-void hash_iterate(hash *h, void (*cb)(hash*, char*, void *val))
+void* table_del(table *t, ulcell key)
 {
-	int i; bucket *b;
-	stack *buckets = stack_create();
-	for (i = 0; i < HASH; i++)
+	slot *s = table_find(t, key);
+	if (!s) return NULL;
+	void *old = s->val;
+	ucell mask = t->limit - 1, i = s - t->slots, j = i, home;
+	// backward shift: pull later members of the probe run into the hole
+	for (;;)
 	{
-		b = h->chains[i];
-		while (b)
+		t->slots[i].val = NULL;
+		for (;;)
 		{
-			stack_push(buckets, b);
-			b = b->next;
+			j = (j + 1) & mask;
+			if (!t->slots[j].val) { t->count--; return old; }
+			home = table_index(t, t->slots[j].key);
+			// leave slots whose home lies cyclically in (i, j]
+			if (i <= j ? (i < home && home <= j): (i < home || home <= j))
+				continue;
+			break;
 		}
+		t->slots[i] = t->slots[j];
+		i = j;
 	}
-	FOR_STACK (b, buckets, bucket*, i)
-		cb(h, b->key, b->val);
-	stack_free(buckets);
+}
+void table_free(table *t, bool vals)
+{
+	ucell i; slot *s;
+	if (vals) FOR_TABLE (s, t, i) free(s->val);
+	free(t->slots);
+	free(t);
+}
+ordset* ordset_create()
+{
+	ordset *s = allocate(sizeof(ordset));
+	s->index = table_create();
+	s->first = NULL; s->last = NULL; s->count = 0;
+	return s;
+}
+bool ordset_has(ordset *s, void *item)
+{
+	return table_get(s->index, (ulcell)item) ? 1: 0;
+}
+void ordset_unlink(ordset *s, setlink *l)
+{
+	if (l->prev) l->prev->next = l->next; else s->first = l->next;
+	if (l->next) l->next->prev = l->prev; else s->last = l->prev;
+}
+// append item, or move it to the end if already present
+void ordset_push(ordset *s, void *item)
+{
+	setlink *l = table_get(s->index, (ulcell)item);
+	if (l) ordset_unlink(s, l);
+	else
+	{
+		l = allocate(sizeof(setlink)); l->item = item;
+		table_set(s->index, (ulcell)item, l);
+		s->count++;
+	}
+	l->next = NULL; l->prev = s->last;
+	if (s->last) s->last->next = l; else s->first = l;
+	s->last = l;
+}
+void ordset_del(ordset *s, void *item)
+{
+	setlink *l = table_del(s->index, (ulcell)item);
+	if (l)
+	{
+		ordset_unlink(s, l);
+		free(l); s->count--;
+	}
+}
+// slot counts back from the most recently pushed item, like stack_get()
+void* ordset_get(ordset *s, ucell slot)
+{
+	setlink *l = s->last;
+	while (l && slot--) l = l->prev;
+	return l ? l->item: NULL;
+}
+void ordset_clear(ordset *s)
+{
+	while (s->first) ordset_del(s, s->first->item);
+}
+void ordset_free(ordset *s)
+{
+	ordset_clear(s);
+	table_free(s->index, 0);
+	free(s);
 }
 stack* strsplit(char *addr, str_cb_chr cb)
 {
@@ -508,6 +720,38 @@ pid_t exec_cmd(char *cmd)
 	}
 	return pid;
 }
+// run cmd with its stdin fed from *infp; stdout and stderr are inherited
+pid_t exec_cmd_pipe(char *cmd, int *infp)
+{
+	int p[2]; pid_t pid;
+	signal(SIGCHLD, catch_exit);
+	if (pipe(p) != 0) return -1;
+	pid = fork();
+	if (!pid)
+	{
+		setsid();
+		close(p[WRITE]);
+		dup2(p[READ], READ);
+		execlp("/bin/sh", "sh", "-c", cmd, NULL);
+		exit(EXIT_FAILURE);
+	}
+	close(p[READ]);
+	if (pid < 0) close(p[WRITE]);
+	else *infp = p[WRITE];
+	return pid;
+}
+ulcell clock_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ulcell)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+// map an edge from a span of o pixels to one of n, rounding to nearest. shared
+// edges map alike, so adjacent regions stay adjacent
+int scale_edge(int e, int o, int n)
+{
+	return (int)(((lcell)e * n + o / 2) / o);
+}
 void ppm_pixel(ppm *ppm, int x, int y, ubyte r, ubyte g, ubyte b)
 {
 	if (x > -1 && y > -1 && x < ppm->w && y < ppm->h)
@@ -592,18 +836,11 @@ char* hash_expect(hash *h, char *keys, char *pattern, int maxsubs, regmatch_t *s
 }
 char* hash_encode(hash *h)
 {
-	int i;
+	ucell i; bucket *b;
 	autostr s; str_create(&s);
-	for (i = 0; i < HASH; i++)
-	{
-		bucket *b = h->chains[i];
-		while (b)
-		{
-			str_print(&s, BLOCK*64, "%d %s %d %s\n", strlen(b->key), b->key,
-				b->val ? strlen(b->val): -1, b->val ? b->val: "");
-			b = b->next;
-		}
-	}
+	FOR_HASH (b, h, i)
+		str_print(&s, BLOCK*64, "%d %s %d %s\n", strlen(b->key), b->key,
+			b->val ? strlen(b->val): -1, b->val ? b->val: "");
 	return s.pad;
 }
 hash* hash_decode(char *s)
@@ -619,13 +856,60 @@ hash* hash_decode(char *s)
 		if (len >= 0)
 		{
 			val = strpull(s, len);
-			s += len; strskip(&s, isspace);
+			s += len;
 		}
+		strskip(&s, isspace);
 		hash_set(h, key, val);
 		free(key);
 	}
 	return h;
 }
+// binary form of a hash for passing between processes: per pair a ucell key
+// length and the key, then an int value length (-1 for no value) and the value
+void hash_pack(hash *h, autostr *s)
+{
+	ucell i; bucket *b;
+	FOR_HASH (b, h, i)
+	{
+		ucell klen = strlen(b->key);
+		int vlen = b->val ? strlen(b->val): -1;
+		str_append(s, (char*)&klen, sizeof(ucell));
+		str_append(s, b->key, klen);
+		str_append(s, (char*)&vlen, sizeof(int));
+		if (vlen > 0) str_append(s, b->val, vlen);
+	}
+}
+// NULL if the data is truncated
+hash* hash_unpack(ubyte *p, ucell len)
+{
+	hash *h = hash_create();
+	ubyte *end = p + len; bool ok = 1;
+	while (ok && p < end)
+	{
+		ucell klen; int vlen; char *key, *val = NULL;
+		ok = 0;
+		if (end - p < sizeof(ucell)) break;
+		memmove(&klen, p, sizeof(ucell)); p += sizeof(ucell);
+		if (end - p < klen + sizeof(int)) break;
+		key = strpull((char*)p, klen); p += klen;
+		memmove(&vlen, p, sizeof(int)); p += sizeof(int);
+		if (vlen > end - p) { free(key); break; }
+		if (vlen >= 0)
+		{
+			val = strpull((char*)p, vlen);
+			p += vlen;
+		}
+		free(hash_set(h, key, val));
+		free(key);
+		ok = 1;
+	}
+	if (!ok)
+	{
+		hash_free(h, 1);
+		h = NULL;
+	}
+	return h;
+}
 // dump mem region to string. decent compression if non-random data.
 char* mem2str(void *addr, ucell len)
 {
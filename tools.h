@@ -32,6 +32,7 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <time.h>
+#include "phash.h"
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -84,19 +85,68 @@ typedef struct {
 	ucell limit;
 } stack;
 
+// ring buffer. both ends push and pop in constant time. limit is always a power of two
+#define DEQUE 32
+typedef struct {
+	void **items;
+	ucell first;
+	ucell depth;
+	ucell limit;
+} deque;
+
+// string keyed open addressing. empty buckets have a NULL key
 #define HASH 32
-typedef struct _bucket {
+#define HASH_NOCASE 0
+#define HASH_CASE 1
+typedef struct {
 	char *key;
 	void *val;
-	struct _bucket *next;
+	ucell code;
 } bucket;
 typedef struct {
-	bucket *chains[HASH];
+	bucket *buckets;
+	ucell count;
+	ucell limit;
+	ubyte mode;
 } hash;
 
+// integer keyed open addressing. empty slots have a NULL val
+#define TABLE 32
+typedef struct {
+	ulcell key;
+	void *val;
+} slot;
+typedef struct {
+	slot *slots;
+	ucell count;
+	ucell limit;
+} table;
+
+// insertion ordered set of pointer sized items. a table maps each item to its link
+// so membership, removal and moving an item to the end are constant time
+typedef struct _setlink {
+	void *item;
+	struct _setlink *prev;
+	struct _setlink *next;
+} setlink;
+typedef struct {
+	table *index;
+	setlink *first;
+	setlink *last;
+	ucell count;
+} ordset;
+
 #define FOR_ARRAY(p,a,b,i) for ((i) = 0; (i) < (sizeof(a)/sizeof(b)) && (((p) = &((a)[i])) || 1); (i)++)
 #define FOR_ARRAY_PART(p,a,b,i,n) for ((i) = 0; (i) < (sizeof(a)/sizeof(b)) && (i) < (n) && (((p) = &((a)[i])) || 1); (i)++)
 #define FOR_STACK(p,s,t,i) for ((i) = 0; (i) < (s)->depth && (((p) = (t)(s)->items[i]) || 1); (i)++)
+#define DEQUE_AT(d,i) ((d)->items[((d)->first + (i)) & ((d)->limit - 1)])
+#define FOR_DEQUE(p,d,t,i) for ((i) = 0; (i) < (d)->depth && (((p) = (t)DEQUE_AT(d,i)) || 1); (i)++)
+// oldest first. l is a setlink*. do not ordset_del() inside the loop
+#define FOR_ORDSET(p,s,t,l) for ((l) = (s)->first; (l) && (((p) = (t)(l)->item) || 1); (l) = (l)->next)
+// visit occupied slots. do not table_set() or table_del() inside the loop
+#define FOR_TABLE(p,t,i) for ((i) = 0; (i) < (t)->limit; (i)++) if (((p) = &(t)->slots[i])->val)
+// visit occupied buckets. do not hash_set() or hash_del() inside the loop
+#define FOR_HASH(p,h,i) for ((i) = 0; (i) < (h)->limit; (i)++) if (((p) = &(h)->buckets[i])->key)
 
 typedef struct {
 	int w, h;
@@ -36,19 +36,48 @@ int stack_find(stack *s, void *item);
 void stack_discard(stack *s, void *item);
 stack *stack_create();
 void stack_free(stack *s);
+deque* deque_create();
+void deque_grow(deque *d);
+void deque_push(deque *d, void *item);
+void* deque_pop(deque *d);
+void deque_shove(deque *d, void *item);
+void* deque_shift(deque *d);
+void deque_free(deque *d);
+hash* hash_create_mode(ubyte mode);
 hash* hash_create();
-ubyte hash_index(char *s);
+ucell hash_code(hash *h, char *s);
+ucell hash_slot(hash *h, char *key, ucell code);
 bucket* hash_find(hash *h, char *key);
 void* hash_get(hash *h, char *key);
+void hash_grow(hash *h);
 void* hash_set(hash *h, char *key, void *val);
 void* hash_del(hash *h, char *key);
 void hash_free(hash *h, bool vals);
 void hash_iterate(hash *h, void (*cb)(hash*, char*, void *val));
+table* table_create();
+ucell table_index(table *t, ulcell key);
+slot* table_find(table *t, ulcell key);
+void* table_get(table *t, ulcell key);
+void table_grow(table *t);
+void* table_set(table *t, ulcell key, void *val);
+void* table_del(table *t, ulcell key);
+void table_free(table *t, bool vals);
+ordset* ordset_create();
+bool ordset_has(ordset *s, void *item);
+void ordset_unlink(ordset *s, setlink *l);
+void ordset_push(ordset *s, void *item);
+void ordset_del(ordset *s, void *item);
+void* ordset_get(ordset *s, ucell slot);
+void ordset_clear(ordset *s);
+void ordset_free(ordset *s);
 stack* strsplit(char *addr, str_cb_chr cb);
 stack* strsplitthese(char *addr, char *join);
 void catch_exit(int sig);
 pid_t exec_cmd_io(const char *command, int *infp, int *outfp);
 pid_t exec_cmd(char *cmd);
+pid_t exec_cmd_pipe(char *cmd, int *infp);
+ulcell clock_ms();
+int scale_edge(int e, int o, int n);
 void ppm_pixel(ppm *ppm, int x, int y, ubyte r, ubyte g, ubyte b);
 ppm* ppm_create(int w, int h, ubyte r, ubyte g, ubyte b);
 void ppm_save(ppm *ppm, const char *name);
@@ -59,6 +88,8 @@ char* hash_get_one(hash *h, char *csv);
 char* hash_expect(hash *h, char *keys, char *pattern, int maxsubs, regmatch_t *subs);
 char* hash_encode(hash *h);
 hash* hash_decode(char *s);
+void hash_pack(hash *h, autostr *s);
+hash* hash_unpack(ubyte *p, ucell len);
 char* mem2str(void *addr, ucell len);
 void str2mem(void *addr, ucell len, char *s);
 ubyte* bm_create(ucell bits);
@@ -47,6 +47,17 @@ void winlist_discard(winlist *s, Window w)
 {
 	int i; for (i = 0; i < s->depth; i++) if (s->items[i] == w) winlist_del(s, i);
 }
+int winlist_find(winlist *s, Window w)
+{
+	int i; for (i = 0; i < s->depth; i++) if (s->items[i] == w) return i;
+	return -1;
+}
+void winlist_insert(winlist *s, ucell index, Window v)
+{
+	winlist_push(s, v);
+	memmove(&(s->items[index+1]), &(s->items[index]), (s->depth - index - 1) * sizeof(Window));
+	s->items[index] = v;
+}
 void *winlist_init(winlist *s)
 {
 	s->items = malloc(sizeof(Window)*(WINLIST+1));
@@ -168,36 +179,41 @@ Window XGetFocus(Display *d)
 	XGetInputFocus(d, &focus, &revert);
 	return (focus == None || focus == PointerRoot) ? DefaultRootWindow(d): focus;
 }
+// constrain a size to WM_NORMAL_HINTS already fetched
+void XApplySizeHints(XSizeHints *hints, int *pw, int *ph)
+{
+	int w = *pw, h = *ph;
+	if (hints->flags & PMinSize)
+	{
+		w = MAX(w, hints->min_width); h = MAX(h, hints->min_height);
+	}
+	if (hints->flags & PMaxSize)
+	{
+		w = MIN(w, hints->max_width); h = MIN(h, hints->max_height);
+	}
+	if (hints->flags & PResizeInc && hints->flags & PBaseSize)
+	{
+		w -= hints->base_width; h -= hints->base_height;
+		w -= w % hints->width_inc; h -= h % hints->height_inc;
+		w += hints->base_width; h += hints->base_height;
+	}
+	if (hints->flags & PAspect)
+	{
+		double ratio = (double)w / h;
+		double minr = (double)hints->min_aspect.x / hints->min_aspect.y;
+		double maxr = (double)hints->max_aspect.x / hints->max_aspect.y;
+			if (ratio < minr) h = (int)round(w / minr);
+		else if (ratio > maxr) w = (int)round(h * maxr);
+	}
+	*pw = w; *ph = h;
+}
 void XFriendlyResize(Display *d, Window win, int x, int y, int w, int h, bool hint, bool center)
 {
 	XSizeHints hints;
 	long userhints;
 	int orig_w = w, orig_h = h;
 	if (hint && XGetWMNormalHints(d, win, &hints, &userhints))
-	{
-		if (hints.flags & PMinSize)
-		{
-			w = MAX(w, hints.min_width); h = MAX(h, hints.min_height);
-		}
-		if (hints.flags & PMaxSize)
-		{
-			w = MIN(w, hints.max_width); h = MIN(h, hints.max_height);
-		}
-		if (hints.flags & PResizeInc && hints.flags & PBaseSize)
-		{
-			w -= hints.base_width; h -= hints.base_height;
-			w -= w % hints.width_inc; h -= h % hints.height_inc;
-			w += hints.base_width; h += hints.base_height;
-		}
-		if (hints.flags & PAspect)
-		{
-			double ratio = (double)w / h;
-			double minr = (double)hints.min_aspect.x / hints.min_aspect.y;
-			double maxr = (double)hints.max_aspect.x / hints.max_aspect.y;
-				if (ratio < minr) h = (int)round(w / minr);
-			else if (ratio > maxr) w = (int)round(h * maxr);
-		}
-	}
+		XApplySizeHints(&hints, &w, &h);
 	if (center && (w < orig_w || h < orig_h))
 	{
 		x += (orig_w - w) / 2;
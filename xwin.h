@@ -52,7 +52,7 @@ NetWMStateShaded, NetWMStateSkipTaskbar, NetWMStateSkipPager, NetWMStateHidden,
 NetWMStateAbove, NetWMStateBelow, NetWMStateDemandsAttention,
 NetWMPid, NetWMDesktop, NetWMUserTime, NetWMUserTimeWindow,
 ApisFlags, ApisReady, ApisCommandCode, ApisCommandIn, ApisResultCode, ApisResultOut, ApisResultError,
-ApisSession, ApisTag,
+ApisSession, ApisTag, ApisSweep, ApisBatchIn, ApisBatchOut,
 AtomLast };
 
 static Atom atoms[AtomLast];
@@ -132,8 +132,12 @@ char *atom_names[AtomLast] = {
 	[ApisCommandIn] = "APIS_COMMAND_IN",
 	[ApisResultCode] = "APIS_RESULT_CODE",
 	[ApisResultOut] = "APIS_RESULT_OUT",
+	[ApisResultError] = "APIS_RESULT_ERROR",
 	[ApisSession] = "APIS_SESSION",
 	[ApisTag] = "APIS_TAG",
+	[ApisSweep] = "APIS_SWEEP",
+	[ApisBatchIn] = "APIS_BATCH_IN",
+	[ApisBatchOut] = "APIS_BATCH_OUT",
 };
 static Atom atoms[AtomLast];
 